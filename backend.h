@@ -0,0 +1,55 @@
+// Copyright 2023 Chris Palmer, https://noncombatant.org/
+// SPDX-License-Identifier: Apache-2.0
+
+#ifndef BACKEND_H
+#define BACKEND_H
+
+#include <stddef.h>
+
+// The operations of a set whose interface matches `HashSet`’s, taking a pointer
+// to its kind of set. This lets test.c and replay.c drive every set
+// implementation through the same code.
+typedef struct SetOperations {
+  void (*add)(void* set, void* element);
+  void* (*get)(const void* set, const void* element);
+  void (*remove)(void* set, const void* element);
+  size_t (*size)(const void* set);
+  // Iterates over the whole set, and returns the number of elements.
+  size_t (*iterate)(const void* set);
+  // `free`s the set’s internal storage, but not the set itself.
+  void (*delete_set)(void* set);
+} SetOperations;
+
+// Defines `Set##Operations`, the `SetOperations` for `Set`, whose interface
+// matches `HashSet`’s.
+#define DEFINE_SET_OPERATIONS(Set)                                    \
+  static void Set##OperationsAdd(void* set, void* element) {          \
+    Set##Add(set, element);                                           \
+  }                                                                   \
+  static void* Set##OperationsGet(const void* set,                    \
+                                  const void* element) {              \
+    return Set##Get(set, element);                                    \
+  }                                                                   \
+  static void Set##OperationsRemove(void* set, const void* element) { \
+    Set##Remove(set, element);                                        \
+  }                                                                   \
+  static size_t Set##OperationsSize(const void* set) {                \
+    return ((const Set*)set)->size;                                   \
+  }                                                                   \
+  static size_t Set##OperationsIterate(const void* set) {             \
+    Set##Iterator it = Set##IteratorNew(set);                         \
+    size_t count = 0;                                                 \
+    while (Set##IteratorNext(&it)) {                                  \
+      count++;                                                        \
+    }                                                                 \
+    return count;                                                     \
+  }                                                                   \
+  static void Set##OperationsDelete(void* set) {                      \
+    Set##Delete(set);                                                 \
+  }                                                                   \
+  static const SetOperations Set##Operations = {                      \
+      Set##OperationsAdd,     Set##OperationsGet,                     \
+      Set##OperationsRemove,  Set##OperationsSize,                    \
+      Set##OperationsIterate, Set##OperationsDelete}
+
+#endif
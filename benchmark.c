@@ -0,0 +1,443 @@
+// Copyright 2023 Chris Palmer, https://noncombatant.org/
+// SPDX-License-Identifier: Apache-2.0
+
+// Benchmarks for `HashSet`. `./benchmark` runs them all; `./benchmark NAME...`
+// runs only the named ones.
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "chunked.h"
+#include "compact.h"
+#include "counter.h"
+#include "cuckoo.h"
+#include "hashset.h"
+#include "inline.h"
+#include "lines.h"
+#include "parallel.h"
+#include "robinhood.h"
+#include "timing.h"
+#include "util.h"
+
+// A record with a key and a value that benchmarks can update.
+typedef struct Record {
+  size_t key;
+  size_t visits;
+} Record;
+
+static size_t RecordHash(const void* record) {
+  const Record* r = record;
+  return r->key;
+}
+
+static int RecordCompare(const void* a, const void* b) {
+  const Record* r1 = a;
+  const Record* r2 = b;
+  if (r1->key < r2->key) {
+    return -1;
+  } else if (r1->key > r2->key) {
+    return 1;
+  }
+  return 0;
+}
+
+// Returns the key of the `i`th `Record`. The keys are random-looking, but
+// distinct: `MixHash` is a bijection. So `Key(i)` for `i` past the end of an
+// array of records is a key that is not in it.
+static size_t Key(size_t i) {
+  return MixHash(i);
+}
+
+// Returns a new array of `count` `Record`s with keys `Key(0)` through
+// `Key(count - 1)`.
+static Record* NewRecords(size_t count) {
+  Record* records = calloc(count, sizeof(Record));
+  for (size_t i = 0; i < count; i++) {
+    records[i].key = Key(i);
+  }
+  return records;
+}
+
+// Returns whether `set` contains `record`. `set` is a pointer to some kind of
+// set.
+typedef bool Lookup(const void* set, const Record* record);
+
+// Measures and prints the latency of looking up keys in `set`, which contains
+// `Key(0)` through `Key(count - 1)`. If `hits`, all the lookups succeed;
+// otherwise they all fail.
+static void MeasureLookups(const char* label,
+                           const void* set,
+                           Lookup* lookup,
+                           size_t count,
+                           bool hits) {
+  const size_t samples = 1 << 20;
+  uint64_t* latencies = calloc(samples, sizeof(uint64_t));
+  const uint64_t overhead = TimerOverhead();
+  for (size_t i = 0; i < samples; i++) {
+    const size_t k = MixHash(i) % count;
+    const Record probe = {.key = Key(hits ? k : count + k)};
+    const uint64_t start = Nanos();
+    const bool found = lookup(set, &probe);
+    const uint64_t elapsed = Nanos() - start;
+    if (found != hits) {
+      abort();
+    }
+    latencies[i] = elapsed > overhead ? elapsed - overhead : 0;
+  }
+  PrintLatencies(label, latencies, samples);
+  free(latencies);
+}
+
+static bool LookupHashSet(const void* set, const Record* record) {
+  return HashSetContains(set, record);
+}
+
+static bool LookupChunkedSet(const void* set, const Record* record) {
+  return ChunkedSetContains(set, record);
+}
+
+static bool LookupCompactSet(const void* set, const Record* record) {
+  return CompactSetContains(set, record);
+}
+
+static bool LookupCuckooSet(const void* set, const Record* record) {
+  return CuckooSetContains(set, record);
+}
+
+static bool LookupInlineSet(const void* set, const Record* record) {
+  return InlineSetContains(set, record);
+}
+
+static bool LookupRobinHoodSet(const void* set, const Record* record) {
+  return RobinHoodSetContains(set, record);
+}
+
+static void Visit(void* record, void* context) {
+  (void)context;
+  Record* r = record;
+  r->visits++;
+}
+
+// Measures `HashSetForEachParallel` throughput at increasing thread counts.
+static void BenchmarkScan() {
+  const size_t count = 1 << 22;
+  Record* records = NewRecords(count);
+  void** elements = calloc(count, sizeof(void*));
+  for (size_t i = 0; i < count; i++) {
+    elements[i] = &records[i];
+  }
+  HashSet set = HashSetBuildParallel(elements, count, 8, count, RecordHash,
+                                     RecordCompare);
+  free(elements);
+
+  for (size_t threads = 1; threads <= 32; threads *= 2) {
+    const double start = Now();
+    HashSetForEachParallel(&set, Visit, NULL, threads);
+    const double seconds = Now() - start;
+    printf("scan threads %2zu: %7.1f M elements/s\n", threads,
+           (double)count / seconds / 1e6);
+  }
+
+  HashSetDelete(&set);
+  free(records);
+}
+
+// Measures how full a `CuckooSet` gets before it first has to use its stash,
+// and its lookup latency compared to `HashSet`.
+static void BenchmarkCuckoo() {
+  for (size_t count = 1 << 10; count <= 1 << 20; count <<= 5) {
+    Record* records = NewRecords(count * CuckooSlots);
+    CuckooSet set = CuckooSetNew(count, RecordHash, RecordCompare);
+    size_t added = 0;
+    while (set.stash_size == 0 && added < count * CuckooSlots) {
+      CuckooSetAdd(&set, &records[added++]);
+    }
+    printf("cuckoo %7zu buckets: load factor %.3f before first stash\n", count,
+           (double)(added - 1) / (double)(count * CuckooSlots));
+    CuckooSetDelete(&set);
+    free(records);
+  }
+
+  // 90% full.
+  const size_t count = 1 << 20;
+  const size_t size = count * CuckooSlots * 9 / 10;
+  Record* records = NewRecords(size);
+  CuckooSet cuckoo = CuckooSetNew(count, RecordHash, RecordCompare);
+  HashSet set = HashSetNew(size, RecordHash, RecordCompare);
+  for (size_t i = 0; i < size; i++) {
+    CuckooSetAdd(&cuckoo, &records[i]);
+    HashSetAdd(&set, &records[i]);
+  }
+  MeasureLookups("cuckoo hit", &cuckoo, LookupCuckooSet, size, true);
+  MeasureLookups("cuckoo miss", &cuckoo, LookupCuckooSet, size, false);
+  MeasureLookups("hashset hit", &set, LookupHashSet, size, true);
+  MeasureLookups("hashset miss", &set, LookupHashSet, size, false);
+  CuckooSetDelete(&cuckoo);
+  HashSetDelete(&set);
+  free(records);
+}
+
+// Measures heavy churn: removing and re-adding elements while keeping the set
+// the same size, and then looking up absent elements.
+static void BenchmarkChurn() {
+  const size_t size = 1 << 20;
+  const size_t rounds = 1 << 23;
+  Record* records = NewRecords(size * 2);
+
+  HashSet set = HashSetNew(size, RecordHash, RecordCompare);
+  RobinHoodSet robin = RobinHoodSetNew(size, RecordHash, RecordCompare);
+  for (size_t i = 0; i < size; i++) {
+    HashSetAdd(&set, &records[i]);
+    RobinHoodSetAdd(&robin, &records[i]);
+  }
+
+  // In each round, remove the oldest element and add a new one.
+  double start = Now();
+  for (size_t i = 0; i < rounds; i++) {
+    HashSetRemove(&set, &records[i % (size * 2)]);
+    HashSetAdd(&set, &records[(i + size) % (size * 2)]);
+  }
+  printf("churn hashset:   %6.1f M rounds/s\n",
+         (double)rounds / (Now() - start) / 1e6);
+  start = Now();
+  for (size_t i = 0; i < rounds; i++) {
+    RobinHoodSetRemove(&robin, &records[i % (size * 2)]);
+    RobinHoodSetAdd(&robin, &records[(i + size) % (size * 2)]);
+  }
+  printf("churn robinhood: %6.1f M rounds/s\n",
+         (double)rounds / (Now() - start) / 1e6);
+
+  MeasureLookups("hashset miss", &set, LookupHashSet, size * 2, false);
+  MeasureLookups("robinhood miss", &robin, LookupRobinHoodSet, size * 2,
+                 false);
+  HashSetDelete(&set);
+  RobinHoodSetDelete(&robin);
+  free(records);
+}
+
+// Measures lookup latency in a `ChunkedSet` and a `HashSet` with 4 elements
+// per bucket, where `HashSet` must chase a pointer per element.
+static void BenchmarkChunked() {
+  const size_t size = 1 << 22;
+  Record* records = NewRecords(size);
+  ChunkedSet chunked = ChunkedSetNew(size / 4, RecordHash, RecordCompare);
+  HashSet set = HashSetNew(size / 4, RecordHash, RecordCompare);
+  for (size_t i = 0; i < size; i++) {
+    ChunkedSetAdd(&chunked, &records[i]);
+    HashSetAdd(&set, &records[i]);
+  }
+  MeasureLookups("chunked hit", &chunked, LookupChunkedSet, size, true);
+  MeasureLookups("chunked miss", &chunked, LookupChunkedSet, size, false);
+  MeasureLookups("hashset hit", &set, LookupHashSet, size, true);
+  MeasureLookups("hashset miss", &set, LookupHashSet, size, false);
+  ChunkedSetDelete(&chunked);
+  HashSetDelete(&set);
+  free(records);
+}
+
+// Measures lookup latency in `InlineSet`s, with and without tags, and a
+// `HashSet`, at load factors of 3/4 (where most buckets have at most 1 element)
+// and 4.
+static void BenchmarkInline() {
+  const size_t size = 3 << 20;
+  Record* records = NewRecords(size);
+  const size_t counts[] = {size * 4 / 3, size / 4};
+  for (size_t c = 0; c < COUNT(counts); c++) {
+    const size_t count = counts[c];
+    InlineSet inlined = InlineSetNew(count, RecordHash, RecordCompare);
+    InlineSet tagged = InlineSetNewWithOptions(count, RecordHash, RecordCompare,
+                                               InlineSetTagged);
+    HashSet set = HashSetNew(count, RecordHash, RecordCompare);
+    for (size_t i = 0; i < size; i++) {
+      InlineSetAdd(&inlined, &records[i]);
+      InlineSetAdd(&tagged, &records[i]);
+      HashSetAdd(&set, &records[i]);
+    }
+    printf("load factor %.2f:\n", (double)size / (double)count);
+    MeasureLookups("inline hit", &inlined, LookupInlineSet, size, true);
+    MeasureLookups("inline miss", &inlined, LookupInlineSet, size, false);
+    MeasureLookups("tagged hit", &tagged, LookupInlineSet, size, true);
+    MeasureLookups("tagged miss", &tagged, LookupInlineSet, size, false);
+    MeasureLookups("hashset hit", &set, LookupHashSet, size, true);
+    MeasureLookups("hashset miss", &set, LookupHashSet, size, false);
+    InlineSetDelete(&inlined);
+    InlineSetDelete(&tagged);
+    HashSetDelete(&set);
+  }
+  free(records);
+}
+
+// Measures the memory overhead per element and lookup latency of a
+// `CompactSet` and a `HashSet`, with as many buckets as elements.
+static void BenchmarkCompact() {
+  const size_t size = 1 << 22;
+  Record* records = NewRecords(size);
+  CompactSet compact = CompactSetNew(size, RecordHash, RecordCompare);
+  HashSet set = HashSetNew(size, RecordHash, RecordCompare);
+  for (size_t i = 0; i < size; i++) {
+    CompactSetAdd(&compact, &records[i]);
+    HashSetAdd(&set, &records[i]);
+  }
+  const size_t compact_bytes = compact.count * sizeof(uint32_t) +
+                               compact.pool_capacity * sizeof(CompactElements);
+  // Assume `malloc` adds 16 bytes to each node.
+  const size_t set_bytes = set.count * sizeof(HashSetElements*) +
+                           set.size * (sizeof(HashSetElements) + 16);
+  printf("compact: %5.1f bytes/element\n",
+         (double)compact_bytes / (double)size);
+  printf("hashset: %5.1f bytes/element\n", (double)set_bytes / (double)size);
+  MeasureLookups("compact hit", &compact, LookupCompactSet, size, true);
+  MeasureLookups("compact miss", &compact, LookupCompactSet, size, false);
+  MeasureLookups("hashset hit", &set, LookupHashSet, size, true);
+  MeasureLookups("hashset miss", &set, LookupHashSet, size, false);
+  CompactSetDelete(&compact);
+  HashSetDelete(&set);
+  free(records);
+}
+
+// Measures lookup latency in a large `HashSet` whose bucket array is backed by
+// huge pages, and then by normal pages.
+static void BenchmarkHugePages() {
+  const size_t size = 1 << 24;
+  Record* records = NewRecords(size);
+  const size_t default_threshold = HugePageThreshold;
+  const size_t thresholds[] = {default_threshold, SIZE_MAX};
+  const char* labels[][2] = {{"huge hit", "huge miss"},
+                             {"normal hit", "normal miss"}};
+  for (size_t t = 0; t < COUNT(thresholds); t++) {
+    HugePageThreshold = thresholds[t];
+    HashSet set = HashSetNew(size, RecordHash, RecordCompare);
+    for (size_t i = 0; i < size; i++) {
+      HashSetAdd(&set, &records[i]);
+    }
+    MeasureLookups(labels[t][0], &set, LookupHashSet, size, true);
+    MeasureLookups(labels[t][1], &set, LookupHashSet, size, false);
+    HashSetDelete(&set);
+  }
+  HugePageThreshold = default_threshold;
+  free(records);
+}
+
+typedef struct Counting {
+  CounterMap* map;
+  Record* records;
+  size_t keys;
+  size_t rounds;
+} Counting;
+
+static void* CountRecords(void* counting) {
+  Counting* c = counting;
+  for (size_t i = 0; i < c->rounds; i++) {
+    // Half the increments go to 1 hot key.
+    const size_t k = i % 2 ? 0 : MixHash(i) % c->keys;
+    CounterMapAdd(c->map, &c->records[k], 1);
+  }
+  return NULL;
+}
+
+// Measures `CounterMap` increment throughput at increasing thread counts, with
+// a skewed distribution of keys.
+static void BenchmarkCounter() {
+  const size_t keys = 1 << 16;
+  const size_t rounds = 1 << 22;
+  Record* records = NewRecords(keys);
+  for (size_t threads = 1; threads <= 32; threads *= 2) {
+    CounterMap map = CounterMapNew(keys, RecordHash, RecordCompare);
+    Counting counting = {
+        .map = &map, .records = records, .keys = keys, .rounds = rounds};
+    pthread_t* ids = calloc(threads, sizeof(pthread_t));
+    const double start = Now();
+    for (size_t i = 0; i < threads; i++) {
+      if (pthread_create(&ids[i], NULL, CountRecords, &counting) != 0) {
+        abort();
+      }
+    }
+    for (size_t i = 0; i < threads; i++) {
+      pthread_join(ids[i], NULL);
+    }
+    const double seconds = Now() - start;
+    printf("counter threads %2zu: %7.1f M increments/s\n", threads,
+           (double)(threads * rounds) / seconds / 1e6);
+    free(ids);
+    CounterMapDelete(&map);
+  }
+  free(records);
+}
+
+// Measures loading a file of 4M lines with `HashSetLoadLines`, compared to
+// reading it with `getline` and copying each line.
+static void BenchmarkLoadLines() {
+  const char* path = "/tmp/hashset-benchmark-lines";
+  FILE* file = fopen(path, "w");
+  if (file == NULL) {
+    abort();
+  }
+  const size_t count = 1 << 22;
+  for (size_t i = 0; i < count; i++) {
+    fprintf(file, "%zx\n", Key(i));
+  }
+  (void)fclose(file);
+
+  double start = Now();
+  LineSet lines;
+  if (!HashSetLoadLines(path, &lines)) {
+    abort();
+  }
+  printf("load lines: %6.1f M lines/s\n",
+         (double)lines.count / (Now() - start) / 1e6);
+  LineSetClose(&lines);
+
+  start = Now();
+  file = fopen(path, "r");
+  HashSet set = HashSetNew(count, StringHash, (Comparator*)strcmp);
+  char* line = NULL;
+  size_t capacity = 0;
+  ssize_t length;
+  while ((length = getline(&line, &capacity, file)) > 0) {
+    line[length - 1] = '\0';
+    HashSetAdd(&set, strdup(line));
+  }
+  (void)fclose(file);
+  printf("getline:    %6.1f M lines/s\n",
+         (double)set.size / (Now() - start) / 1e6);
+  free(line);
+  HashSetIterator it = HashSetIteratorNew(&set);
+  void* element;
+  while ((element = HashSetIteratorNext(&it))) {
+    free(element);
+  }
+  HashSetDelete(&set);
+  (void)remove(path);
+}
+
+typedef struct Benchmark {
+  const char* name;
+  void (*run)(void);
+} Benchmark;
+
+static const Benchmark Benchmarks[] = {
+    {.name = "scan", .run = BenchmarkScan},
+    {.name = "cuckoo", .run = BenchmarkCuckoo},
+    {.name = "churn", .run = BenchmarkChurn},
+    {.name = "chunked", .run = BenchmarkChunked},
+    {.name = "inline", .run = BenchmarkInline},
+    {.name = "compact", .run = BenchmarkCompact},
+    {.name = "hugepages", .run = BenchmarkHugePages},
+    {.name = "counter", .run = BenchmarkCounter},
+    {.name = "lines", .run = BenchmarkLoadLines},
+};
+
+int main(int count, char* arguments[]) {
+  for (size_t i = 0; i < COUNT(Benchmarks); i++) {
+    bool selected = count < 2;
+    for (int j = 1; j < count; j++) {
+      selected = selected || StringEquals(arguments[j], Benchmarks[i].name);
+    }
+    if (selected) {
+      Benchmarks[i].run();
+    }
+  }
+}
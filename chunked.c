@@ -0,0 +1,142 @@
+// Copyright 2023 Chris Palmer, https://noncombatant.org/
+// SPDX-License-Identifier: Apache-2.0
+
+#include <assert.h>
+#include <stdlib.h>
+
+#include "chunked.h"
+#include "util.h"
+
+static_assert(sizeof(ChunkedElements) == 64, "1 node per cache line");
+
+static uint8_t Tag(size_t hash) {
+  // The low bits choose the bucket, so use the high ones, after `MixHash`
+  // because many `Hasher`s leave them 0.
+  return (uint8_t)(MixHash(hash) >> (sizeof(size_t) * 8 - 8));
+}
+
+// The location of an element: a node and a slot in it.
+typedef struct Slot {
+  ChunkedElements* chunk;
+  size_t slot;
+} Slot;
+
+// Returns the slot of the element in `bucket` matching `element`, or a `Slot`
+// whose `chunk` is `NULL`.
+static Slot Find(const ChunkedSet* set,
+                 size_t bucket,
+                 const void* element,
+                 uint8_t tag) {
+  for (ChunkedElements* c = set->buckets[bucket]; c; c = c->next) {
+    for (size_t i = 0; i < c->length; i++) {
+      if (c->tags[i] == tag && set->comparator(c->elements[i], element) == 0) {
+        return (Slot){.chunk = c, .slot = i};
+      }
+    }
+  }
+  return (Slot){.chunk = NULL, .slot = 0};
+}
+
+void ChunkedSetAdd(ChunkedSet* set, void* element) {
+  const size_t hash = set->hasher(element);
+  const size_t bucket = hash % set->count;
+  const uint8_t tag = Tag(hash);
+  const Slot s = Find(set, bucket, element, tag);
+  if (s.chunk) {
+    s.chunk->elements[s.slot] = element;
+    return;
+  }
+
+  ChunkedElements** link = &set->buckets[bucket];
+  while (*link && (*link)->next) {
+    link = &(*link)->next;
+  }
+  ChunkedElements* last = *link;
+  if (last == NULL || last->length == ChunkSlots) {
+    if (last) {
+      link = &last->next;
+    }
+    last = aligned_alloc(sizeof(ChunkedElements), sizeof(ChunkedElements));
+    *last = (ChunkedElements){.next = NULL, .length = 0};
+    *link = last;
+  }
+  last->elements[last->length] = element;
+  last->tags[last->length] = tag;
+  last->length++;
+  set->size++;
+}
+
+bool ChunkedSetContains(const ChunkedSet* set, const void* element) {
+  return ChunkedSetGet(set, element) != NULL;
+}
+
+void ChunkedSetDelete(ChunkedSet* set) {
+  for (size_t i = 0; i < set->count; i++) {
+    ChunkedElements* c = set->buckets[i];
+    while (c) {
+      ChunkedElements* next = c->next;
+      free(c);
+      c = next;
+    }
+  }
+  FreeHuge(set->buckets);
+}
+
+void* ChunkedSetGet(const ChunkedSet* set, const void* element) {
+  const size_t hash = set->hasher(element);
+  const Slot s = Find(set, hash % set->count, element, Tag(hash));
+  return s.chunk ? s.chunk->elements[s.slot] : NULL;
+}
+
+ChunkedSet ChunkedSetNew(size_t count, Hasher* hasher, Comparator* comparator) {
+  return (ChunkedSet){.count = count,
+                      .buckets = CallocHuge(count, sizeof(ChunkedElements*)),
+                      .hasher = hasher,
+                      .comparator = comparator};
+}
+
+void ChunkedSetRemove(ChunkedSet* set, const void* element) {
+  const size_t hash = set->hasher(element);
+  const size_t bucket = hash % set->count;
+  const Slot s = Find(set, bucket, element, Tag(hash));
+  if (s.chunk == NULL) {
+    return;
+  }
+
+  // Fill the hole with the bucket’s last element.
+  ChunkedElements** link = &set->buckets[bucket];
+  while ((*link)->next) {
+    link = &(*link)->next;
+  }
+  ChunkedElements* last = *link;
+  last->length--;
+  s.chunk->elements[s.slot] = last->elements[last->length];
+  s.chunk->tags[s.slot] = last->tags[last->length];
+  if (last->length == 0) {
+    free(last);
+    *link = NULL;
+  }
+  set->size--;
+}
+
+ChunkedSetIterator ChunkedSetIteratorNew(const ChunkedSet* set) {
+  return (ChunkedSetIterator){
+      .bucket = 0, .slot = 0, .chunk = set->buckets[0], .set = set};
+}
+
+void* ChunkedSetIteratorNext(ChunkedSetIterator* i) {
+  while (true) {
+    if (i->chunk && i->slot < i->chunk->length) {
+      return i->chunk->elements[i->slot++];
+    }
+    if (i->chunk && i->chunk->next) {
+      i->chunk = i->chunk->next;
+    } else if (i->bucket + 1 < i->set->count) {
+      i->bucket++;
+      i->chunk = i->set->buckets[i->bucket];
+    } else {
+      return NULL;
+    }
+    i->slot = 0;
+  }
+}
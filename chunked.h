@@ -0,0 +1,80 @@
+// Copyright 2023 Chris Palmer, https://noncombatant.org/
+// SPDX-License-Identifier: Apache-2.0
+
+#ifndef CHUNKED_H
+#define CHUNKED_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "hashset.h"
+
+// A set with the same interface as `HashSet`, but whose bucket lists are
+// “unrolled”: each node is 1 cache line, and holds up to `ChunkSlots`
+// elements. At ordinary load factors, nearly every bucket is a single node, so
+// walking a bucket costs 1 cache miss instead of 1 per element. The overhead
+// per element is also smaller: 64 bytes for up to 6 elements, instead of 16
+// bytes (plus `malloc`’s header) for each one.
+//
+// Each node also stores an 8-bit tag for each element, taken from its hash
+// after `MixHash`, so that lookups call the `Comparator` (and touch the
+// element’s memory) only for elements whose tags match. The tags work even for
+// `Hasher`s whose high bits are all 0.
+//
+// In each bucket, only the last node can have empty slots: removing an element
+// moves the bucket’s last element into its slot.
+
+enum { ChunkSlots = 6 };
+
+typedef struct ChunkedElements {
+  void* elements[ChunkSlots];
+  struct ChunkedElements* next;
+  // The top 8 bits of each element’s hash, after `MixHash`.
+  uint8_t tags[ChunkSlots];
+  // The number of slots in use.
+  uint16_t length;
+} ChunkedElements;
+
+typedef struct ChunkedSet {
+  // The number of buckets.
+  size_t count;
+  // The number of elements.
+  size_t size;
+  ChunkedElements** buckets;
+  Hasher* hasher;
+  Comparator* comparator;
+} ChunkedSet;
+
+void ChunkedSetAdd(ChunkedSet* set, void* element);
+
+bool ChunkedSetContains(const ChunkedSet* set, const void* element);
+
+// `free`s the `ChunkedSet`’s internal storage, but not the elements. The caller
+// owns the elements.
+void ChunkedSetDelete(ChunkedSet* set);
+
+// Returns the element in `set` matching the key part of `element`, or `NULL` if
+// no matching element is present.
+void* ChunkedSetGet(const ChunkedSet* set, const void* element);
+
+ChunkedSet ChunkedSetNew(size_t count, Hasher* hasher, Comparator* comparator);
+
+// Removes from `set` the element matching the key part of `element`, if one is
+// present.
+void ChunkedSetRemove(ChunkedSet* set, const void* element);
+
+typedef struct ChunkedSetIterator {
+  size_t bucket;
+  size_t slot;
+  const ChunkedElements* chunk;
+  const ChunkedSet* set;
+} ChunkedSetIterator;
+
+// Returns a `ChunkedSetIterator` that starts at the beginning of `set`.
+ChunkedSetIterator ChunkedSetIteratorNew(const ChunkedSet* set);
+
+// Returns the next element, or `NULL` if iteration has ended.
+void* ChunkedSetIteratorNext(ChunkedSetIterator* i);
+
+#endif
@@ -0,0 +1,125 @@
+// Copyright 2023 Chris Palmer, https://noncombatant.org/
+// SPDX-License-Identifier: Apache-2.0
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "compact.h"
+#include "util.h"
+
+static uint32_t Tag(size_t hash) {
+  // The low bits choose the bucket, so use the high ones, after `MixHash`
+  // because many `Hasher`s leave them 0.
+  return (uint32_t)((uint64_t)MixHash(hash) >> 32);
+}
+
+// Returns the index of the node matching `element` in the bucket of `hash`,
+// or 0.
+static uint32_t Find(const CompactSet* set, size_t hash, const void* element) {
+  const uint32_t tag = Tag(hash);
+  for (uint32_t i = set->buckets[hash % set->count]; i != 0;
+       i = set->pool[i].next) {
+    const CompactElements* e = &set->pool[i];
+    if (e->tag == tag && set->comparator(e->element, element) == 0) {
+      return i;
+    }
+  }
+  return 0;
+}
+
+// Returns the index of an unused node, growing the pool if necessary.
+static uint32_t NewNode(CompactSet* set) {
+  if (set->free != 0) {
+    const uint32_t i = (uint32_t)set->free;
+    set->free = set->pool[i].next;
+    return i;
+  }
+  if (set->pool_size == set->pool_capacity) {
+    if (set->pool_capacity == UINT32_MAX) {
+      abort();
+    }
+    size_t capacity = set->pool_capacity * 2;
+    if (capacity > UINT32_MAX) {
+      capacity = UINT32_MAX;
+    }
+    // Not `realloc`, which would lose the huge pages of a big pool.
+    CompactElements* pool = CallocHuge(capacity, sizeof(CompactElements));
+    memcpy(pool, set->pool, set->pool_size * sizeof(CompactElements));
+    FreeHuge(set->pool);
+    set->pool = pool;
+    set->pool_capacity = capacity;
+  }
+  return (uint32_t)set->pool_size++;
+}
+
+void CompactSetAdd(CompactSet* set, void* element) {
+  const size_t hash = set->hasher(element);
+  const uint32_t found = Find(set, hash, element);
+  if (found != 0) {
+    set->pool[found].element = element;
+    return;
+  }
+
+  const uint32_t i = NewNode(set);
+  uint32_t* bucket = &set->buckets[hash % set->count];
+  set->pool[i] =
+      (CompactElements){.element = element, .next = *bucket, .tag = Tag(hash)};
+  *bucket = i;
+  set->size++;
+}
+
+bool CompactSetContains(const CompactSet* set, const void* element) {
+  return CompactSetGet(set, element) != NULL;
+}
+
+void CompactSetDelete(CompactSet* set) {
+  FreeHuge(set->buckets);
+  FreeHuge(set->pool);
+}
+
+void* CompactSetGet(const CompactSet* set, const void* element) {
+  const uint32_t i = Find(set, set->hasher(element), element);
+  return i == 0 ? NULL : set->pool[i].element;
+}
+
+CompactSet CompactSetNew(size_t count, Hasher* hasher, Comparator* comparator) {
+  const size_t capacity = 16;
+  return (CompactSet){.count = count,
+                      .buckets = CallocHuge(count, sizeof(uint32_t)),
+                      .pool = CallocHuge(capacity, sizeof(CompactElements)),
+                      .pool_size = 1,
+                      .pool_capacity = capacity,
+                      .hasher = hasher,
+                      .comparator = comparator};
+}
+
+void CompactSetRemove(CompactSet* set, const void* element) {
+  const size_t hash = set->hasher(element);
+  const uint32_t tag = Tag(hash);
+  uint32_t* link = &set->buckets[hash % set->count];
+  for (uint32_t i; (i = *link) != 0; link = &set->pool[i].next) {
+    CompactElements* e = &set->pool[i];
+    if (e->tag == tag && set->comparator(e->element, element) == 0) {
+      *link = e->next;
+      *e = (CompactElements){
+          .element = NULL, .next = (uint32_t)set->free, .tag = 0};
+      set->free = i;
+      set->size--;
+      return;
+    }
+  }
+}
+
+CompactSetIterator CompactSetIteratorNew(const CompactSet* set) {
+  return (CompactSetIterator){.node = 1, .set = set};
+}
+
+void* CompactSetIteratorNext(CompactSetIterator* i) {
+  while (i->node < i->set->pool_size) {
+    void* element = i->set->pool[i->node++].element;
+    if (element) {
+      return element;
+    }
+  }
+  return NULL;
+}
@@ -0,0 +1,88 @@
+// Copyright 2023 Chris Palmer, https://noncombatant.org/
+// SPDX-License-Identifier: Apache-2.0
+
+#ifndef COMPACT_H
+#define COMPACT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "hashset.h"
+
+// A set with the same interface as `HashSet`, but using less memory for large
+// sets. Instead of `malloc`ing each list node, it keeps them all in 1 growable
+// array (the “pool”), and links them by 32-bit indices into it. Buckets, too,
+// are 32-bit indices.
+//
+// Each element then costs 16 bytes (its pointer, a link, and 32 bits of its
+// hash), plus 4 bytes per bucket, instead of 16 bytes plus `malloc`’s header
+// (often another 16) plus 8 bytes per bucket. Nodes are also close together
+// in memory, rather than wherever `malloc` put them.
+//
+// The hash bits let lookups skip most colliding elements without calling the
+// `Comparator`.
+//
+// A `CompactSet` can hold at most `UINT32_MAX - 1` elements; adding more
+// aborts.
+
+typedef struct CompactElements {
+  void* element;
+  // The index in the pool of the next node in the list, or 0 at the end.
+  uint32_t next;
+  // The top 32 bits of the element’s hash, after `MixHash`.
+  uint32_t tag;
+} CompactElements;
+
+typedef struct CompactSet {
+  // The number of buckets.
+  size_t count;
+  // The number of elements.
+  size_t size;
+  // The index in `pool` of each bucket’s first node, or 0 if it’s empty.
+  uint32_t* buckets;
+  // Node 0 is never used, so that 0 can mean “none”. Removed nodes have a
+  // `NULL` `element`, and are linked into the free list.
+  CompactElements* pool;
+  // The number of nodes in `pool` that have ever been used, including node 0.
+  size_t pool_size;
+  // The number of nodes allocated for `pool`.
+  size_t pool_capacity;
+  // The index of the first node in the free list, or 0 if it’s empty.
+  size_t free;
+  Hasher* hasher;
+  Comparator* comparator;
+} CompactSet;
+
+void CompactSetAdd(CompactSet* set, void* element);
+
+bool CompactSetContains(const CompactSet* set, const void* element);
+
+// `free`s the `CompactSet`’s internal storage, but not the elements. The caller
+// owns the elements.
+void CompactSetDelete(CompactSet* set);
+
+// Returns the element in `set` matching the key part of `element`, or `NULL` if
+// no matching element is present.
+void* CompactSetGet(const CompactSet* set, const void* element);
+
+CompactSet CompactSetNew(size_t count, Hasher* hasher, Comparator* comparator);
+
+// Removes from `set` the element matching the key part of `element`, if one is
+// present.
+void CompactSetRemove(CompactSet* set, const void* element);
+
+typedef struct CompactSetIterator {
+  // The index of the next node in the pool to visit. Iteration goes through the
+  // pool in order, rather than bucket by bucket.
+  size_t node;
+  const CompactSet* set;
+} CompactSetIterator;
+
+// Returns a `CompactSetIterator` that starts at the beginning of `set`.
+CompactSetIterator CompactSetIteratorNew(const CompactSet* set);
+
+// Returns the next element, or `NULL` if iteration has ended.
+void* CompactSetIteratorNext(CompactSetIterator* i);
+
+#endif
@@ -0,0 +1,175 @@
+// Copyright 2023 Chris Palmer, https://noncombatant.org/
+// SPDX-License-Identifier: Apache-2.0
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "counter.h"
+#include "util.h"
+
+// How many times a counter’s increments may pass from one thread to another
+// before the counter is split.
+enum { MaxHandoffs = 64 };
+
+static Counter* Find(Counter* c, const CounterMap* map, const void* key) {
+  for (; c; c = c->next) {
+    if (map->comparator(c->key, key) == 0) {
+      return c;
+    }
+  }
+  return NULL;
+}
+
+// Returns the counter for `key`, adding it if necessary.
+static Counter* FindOrAdd(CounterMap* map, void* key) {
+  _Atomic(Counter*)* bucket = &map->buckets[map->hasher(key) % map->count];
+  Counter* head = atomic_load_explicit(bucket, memory_order_acquire);
+  Counter* found = Find(head, map, key);
+  if (found) {
+    return found;
+  }
+
+  Counter* c = malloc(sizeof(Counter));
+  c->key = key;
+  atomic_init(&c->value, 0);
+  atomic_init(&c->last, 0);
+  atomic_init(&c->handoffs, 0);
+  atomic_init(&c->shards, NULL);
+  while (true) {
+    c->next = head;
+    if (atomic_compare_exchange_weak_explicit(bucket, &head, c,
+                                              memory_order_release,
+                                              memory_order_acquire)) {
+      atomic_fetch_add_explicit(&map->size, 1, memory_order_relaxed);
+      return c;
+    }
+    // Another thread pushed onto the list (or the exchange failed spuriously).
+    // Check only the counters pushed since we last looked.
+    for (Counter* d = head; d != c->next; d = d->next) {
+      if (map->comparator(d->key, key) == 0) {
+        free(c);
+        return d;
+      }
+    }
+  }
+}
+
+// Returns a value that identifies this thread.
+static uintptr_t ThisThread(void) {
+  static _Thread_local char marker;
+  return (uintptr_t)&marker;
+}
+
+// Returns this thread’s shard index. There are only `CounterShards` shards, so
+// threads can share them.
+static size_t ThisShard(void) {
+  return MixHash((size_t)ThisThread()) % CounterShards;
+}
+
+static CounterShard* Split(Counter* c) {
+  CounterShard* shards = aligned_alloc(sizeof(CounterShard),
+                                       CounterShards * sizeof(CounterShard));
+  for (size_t i = 0; i < CounterShards; i++) {
+    atomic_init(&shards[i].value, 0);
+  }
+  CounterShard* expected = NULL;
+  if (!atomic_compare_exchange_strong_explicit(&c->shards, &expected, shards,
+                                               memory_order_acq_rel,
+                                               memory_order_acquire)) {
+    // Another thread split it first.
+    free(shards);
+    return expected;
+  }
+  return shards;
+}
+
+// Returns the sum of `c`’s counter and its shards.
+static uint64_t Value(const Counter* c) {
+  uint64_t value = atomic_load_explicit(&c->value, memory_order_relaxed);
+  const CounterShard* shards =
+      atomic_load_explicit(&c->shards, memory_order_acquire);
+  for (size_t i = 0; shards && i < CounterShards; i++) {
+    value += atomic_load_explicit(&shards[i].value, memory_order_relaxed);
+  }
+  return value;
+}
+
+void CounterMapAdd(CounterMap* map, void* key, uint64_t delta) {
+  Counter* c = FindOrAdd(map, key);
+  CounterShard* shards = atomic_load_explicit(&c->shards, memory_order_acquire);
+  if (shards == NULL) {
+    atomic_fetch_add_explicit(&c->value, delta, memory_order_relaxed);
+    // The add already owns the cache line, so noting the last thread costs no
+    // more traffic.
+    const uintptr_t thread = ThisThread();
+    if (atomic_exchange_explicit(&c->last, thread, memory_order_relaxed) !=
+            thread &&
+        atomic_fetch_add_explicit(&c->handoffs, 1, memory_order_relaxed) + 1 ==
+            MaxHandoffs) {
+      Split(c);
+    }
+    return;
+  }
+  atomic_fetch_add_explicit(&shards[ThisShard()].value, delta,
+                            memory_order_relaxed);
+}
+
+void CounterMapDelete(CounterMap* map) {
+  for (size_t i = 0; i < map->count; i++) {
+    Counter* c = atomic_load_explicit(&map->buckets[i], memory_order_relaxed);
+    while (c) {
+      Counter* next = c->next;
+      free(atomic_load_explicit(&c->shards, memory_order_relaxed));
+      free(c);
+      c = next;
+    }
+  }
+  free(map->buckets);
+}
+
+uint64_t CounterMapGet(const CounterMap* map, const void* key) {
+  Counter* head = atomic_load_explicit(
+      &map->buckets[map->hasher(key) % map->count], memory_order_acquire);
+  const Counter* c = Find(head, map, key);
+  return c ? Value(c) : 0;
+}
+
+CounterMap CounterMapNew(size_t count, Hasher* hasher, Comparator* comparator) {
+  CounterMap map = {.count = count,
+                    .buckets = calloc(count, sizeof(_Atomic(Counter*))),
+                    .hasher = hasher,
+                    .comparator = comparator};
+  atomic_init(&map.size, 0);
+  return map;
+}
+
+void CounterMapSplit(CounterMap* map, void* key) {
+  Counter* c = FindOrAdd(map, key);
+  if (atomic_load_explicit(&c->shards, memory_order_acquire) == NULL) {
+    Split(c);
+  }
+}
+
+CounterMapIterator CounterMapIteratorNew(const CounterMap* map) {
+  return (CounterMapIterator){
+      .bucket = 0,
+      .counter = atomic_load_explicit(&map->buckets[0], memory_order_acquire),
+      .map = map};
+}
+
+void* CounterMapIteratorNext(CounterMapIterator* i, uint64_t* value) {
+  while (true) {
+    if (i->counter) {
+      const Counter* c = i->counter;
+      i->counter = c->next;
+      *value = Value(c);
+      return c->key;
+    }
+    if (i->bucket + 1 >= i->map->count) {
+      return NULL;
+    }
+    i->bucket++;
+    i->counter = atomic_load_explicit(&i->map->buckets[i->bucket],
+                                      memory_order_acquire);
+  }
+}
@@ -0,0 +1,92 @@
+// Copyright 2023 Chris Palmer, https://noncombatant.org/
+// SPDX-License-Identifier: Apache-2.0
+
+#ifndef COUNTER_H
+#define COUNTER_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "hashset.h"
+
+// A map from keys to 64-bit counters, which many threads can update at once
+// without locks. Keys are opaque, like `HashSet` elements: the map sees them
+// only through its `Hasher` and `Comparator`, and the caller owns them.
+//
+// Adding a new key pushes it onto its bucket’s list with a compare-and-swap;
+// since keys are never removed, lists only grow at the head, and readers can
+// walk them without synchronizing with writers. Incrementing an existing key is
+// an atomic add on its counter.
+//
+// A very hot key would make all the threads contend for its counter’s cache
+// line. So when increments of a counter keep coming from different threads, the
+// key is split: it gets `CounterShards` sub-counters, each on its own cache
+// line, and each thread then adds to the one its identity hashes to. With more
+// threads than shards, some threads share a shard, so those adds are atomic
+// too. Reading the counter sums them all.
+
+enum { CounterShards = 16 };
+
+typedef struct CounterShard {
+  atomic_uint_least64_t value;
+  char padding[64 - sizeof(atomic_uint_least64_t)];
+} CounterShard;
+
+typedef struct Counter {
+  void* key;
+  // Immutable once the counter is in the map.
+  struct Counter* next;
+  atomic_uint_least64_t value;
+  // The thread that last added to `value`, and how many times that changed.
+  atomic_uintptr_t last;
+  atomic_size_t handoffs;
+  // `CounterShards` sub-counters, once the key is split.
+  _Atomic(CounterShard*) shards;
+} Counter;
+
+typedef struct CounterMap {
+  // The number of buckets.
+  size_t count;
+  // The number of keys.
+  atomic_size_t size;
+  _Atomic(Counter*)* buckets;
+  Hasher* hasher;
+  Comparator* comparator;
+} CounterMap;
+
+// Adds `delta` to the counter for `key`, first adding `key` (with a counter of
+// 0) if it is not present. Thread-safe.
+void CounterMapAdd(CounterMap* map, void* key, uint64_t delta);
+
+// `free`s the `CounterMap`’s internal storage, but not the keys. The caller
+// owns the keys. No other thread may be using `map`.
+void CounterMapDelete(CounterMap* map);
+
+// Returns the counter for `key`, or 0 if `key` is not present. Thread-safe,
+// but if other threads are adding to the counter, the result might not include
+// all of their increments.
+uint64_t CounterMapGet(const CounterMap* map, const void* key);
+
+CounterMap CounterMapNew(size_t count, Hasher* hasher, Comparator* comparator);
+
+// Splits the counter for `key` (adding `key` if it is not present), as if it
+// had become contended. This is useful for keys that are known in advance to
+// be hot. Thread-safe.
+void CounterMapSplit(CounterMap* map, void* key);
+
+typedef struct CounterMapIterator {
+  size_t bucket;
+  const Counter* counter;
+  const CounterMap* map;
+} CounterMapIterator;
+
+// Returns a `CounterMapIterator` that starts at the beginning of `map`. Keys
+// added during iteration might or might not be visited.
+CounterMapIterator CounterMapIteratorNew(const CounterMap* map);
+
+// Returns the next key, and sets `*value` to its counter, or returns `NULL` if
+// iteration has ended.
+void* CounterMapIteratorNext(CounterMapIterator* i, uint64_t* value);
+
+#endif
@@ -0,0 +1,261 @@
+// Copyright 2023 Chris Palmer, https://noncombatant.org/
+// SPDX-License-Identifier: Apache-2.0
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "cuckoo.h"
+#include "util.h"
+
+// How many elements to evict while adding an element, before giving up and
+// using the stash.
+enum { MaxEvictions = 500 };
+
+static const size_t NotFound = SIZE_MAX;
+
+// Slots are numbered as in `CuckooSetIterator`: first all the buckets’ slots,
+// then the stash.
+static size_t StashSlot(const CuckooSet* set, size_t i) {
+  return set->count * CuckooSlots + i;
+}
+
+static size_t Bucket1(const CuckooSet* set, size_t hash) {
+  return MixHash(hash) & (set->count - 1);
+}
+
+static size_t Bucket2(const CuckooSet* set, size_t hash) {
+  return MixHash(~hash) & (set->count - 1);
+}
+
+static size_t NextRandom(CuckooSet* set) {
+  // xorshift64
+  size_t x = set->random;
+  x ^= x << 13;
+  x ^= x >> 7;
+  x ^= x << 17;
+  set->random = x;
+  return x;
+}
+
+static size_t FindInBucket(const CuckooSet* set,
+                           size_t b,
+                           const void* element,
+                           size_t hash) {
+  const CuckooBucket* bucket = &set->buckets[b];
+  for (size_t i = 0; i < CuckooSlots; i++) {
+    if (bucket->hashes[i] == hash && bucket->elements[i] &&
+        set->comparator(bucket->elements[i], element) == 0) {
+      return b * CuckooSlots + i;
+    }
+  }
+  return NotFound;
+}
+
+// Returns the slot of the element matching `element`, or `NotFound`.
+static size_t Find(const CuckooSet* set, const void* element, size_t hash) {
+  size_t slot = FindInBucket(set, Bucket1(set, hash), element, hash);
+  if (slot == NotFound) {
+    slot = FindInBucket(set, Bucket2(set, hash), element, hash);
+  }
+  for (size_t i = 0; slot == NotFound && i < set->stash_size; i++) {
+    if (set->stash_hashes[i] == hash &&
+        set->comparator(set->stash[i], element) == 0) {
+      slot = StashSlot(set, i);
+    }
+  }
+  return slot;
+}
+
+static bool PlaceInBucket(CuckooSet* set,
+                          size_t b,
+                          void* element,
+                          size_t hash) {
+  CuckooBucket* bucket = &set->buckets[b];
+  for (size_t i = 0; i < CuckooSlots; i++) {
+    if (bucket->elements[i] == NULL) {
+      bucket->elements[i] = element;
+      bucket->hashes[i] = hash;
+      return true;
+    }
+  }
+  return false;
+}
+
+// Puts `element`, which must not already be in `set`, in one of its buckets or
+// the stash. If there is no room, returns false, and sets `*element` and
+// `*hash` to the element left without a place (which, after evictions, may be
+// a different one).
+static bool Place(CuckooSet* set, void** element, size_t* hash) {
+  if (PlaceInBucket(set, Bucket1(set, *hash), *element, *hash)) {
+    return true;
+  }
+  size_t b = Bucket2(set, *hash);
+  for (size_t i = 0; i < MaxEvictions; i++) {
+    if (PlaceInBucket(set, b, *element, *hash)) {
+      return true;
+    }
+    // Swap `element` with a random victim in `b`. The victim becomes the
+    // element to place, in its other bucket.
+    CuckooBucket* bucket = &set->buckets[b];
+    const size_t victim = NextRandom(set) % CuckooSlots;
+    void* e = bucket->elements[victim];
+    const size_t h = bucket->hashes[victim];
+    bucket->elements[victim] = *element;
+    bucket->hashes[victim] = *hash;
+    *element = e;
+    *hash = h;
+    const size_t b1 = Bucket1(set, *hash);
+    b = b1 == b ? Bucket2(set, *hash) : b1;
+  }
+
+  if (set->stash_size < CuckooStashSize) {
+    set->stash[set->stash_size] = *element;
+    set->stash_hashes[set->stash_size] = *hash;
+    set->stash_size++;
+    return true;
+  }
+  return false;
+}
+
+// Places `element` in `set`, or failing that, in its overflow set.
+static void PlaceOrOverflow(CuckooSet* set, void* element, size_t hash) {
+  if (!Place(set, &element, &hash)) {
+    HashSetAddWithHash(&set->overflow, element, hash);
+  }
+}
+
+// Doubles the number of buckets, and re-places all the elements, including
+// those in the overflow set.
+static void Grow(CuckooSet* set) {
+  CuckooSet bigger =
+      CuckooSetNew(set->count * 2, set->hasher, set->comparator);
+  bigger.size = set->size;
+  bigger.random = set->random;
+  for (size_t b = 0; b < set->count; b++) {
+    const CuckooBucket* bucket = &set->buckets[b];
+    for (size_t i = 0; i < CuckooSlots; i++) {
+      if (bucket->elements[i]) {
+        PlaceOrOverflow(&bigger, bucket->elements[i], bucket->hashes[i]);
+      }
+    }
+  }
+  for (size_t i = 0; i < set->stash_size; i++) {
+    PlaceOrOverflow(&bigger, set->stash[i], set->stash_hashes[i]);
+  }
+  HashSetIterator it = HashSetIteratorNew(&set->overflow);
+  void* element;
+  while ((element = HashSetIteratorNext(&it))) {
+    PlaceOrOverflow(&bigger, element, set->hasher(element));
+  }
+  CuckooSetDelete(set);
+  *set = bigger;
+}
+
+static void* ElementAt(const CuckooSet* set, size_t slot) {
+  if (slot >= StashSlot(set, 0)) {
+    return set->stash[slot - StashSlot(set, 0)];
+  }
+  return set->buckets[slot / CuckooSlots].elements[slot % CuckooSlots];
+}
+
+void CuckooSetAdd(CuckooSet* set, void* element) {
+  size_t hash = set->hasher(element);
+  const size_t slot = Find(set, element, hash);
+  if (slot == NotFound) {
+    if (set->overflow.size > 0 &&
+        HashSetContainsWithHash(&set->overflow, element, hash)) {
+      HashSetAddWithHash(&set->overflow, element, hash);
+      return;
+    }
+    set->size++;
+    if (Place(set, &element, &hash)) {
+      return;
+    }
+    // Growing helps only if the buckets are fairly full. Otherwise, the
+    // `Hasher` has given too many elements the same buckets, and growing could
+    // go on forever without finding room for them.
+    const size_t placed = set->size - set->stash_size - set->overflow.size;
+    if (placed >= set->count * CuckooSlots / 2) {
+      Grow(set);
+    }
+    PlaceOrOverflow(set, element, hash);
+  } else if (slot >= StashSlot(set, 0)) {
+    set->stash[slot - StashSlot(set, 0)] = element;
+  } else {
+    set->buckets[slot / CuckooSlots].elements[slot % CuckooSlots] = element;
+  }
+}
+
+bool CuckooSetContains(const CuckooSet* set, const void* element) {
+  return CuckooSetGet(set, element) != NULL;
+}
+
+void CuckooSetDelete(CuckooSet* set) {
+  FreeHuge(set->buckets);
+  HashSetDelete(&set->overflow);
+}
+
+void* CuckooSetGet(const CuckooSet* set, const void* element) {
+  const size_t hash = set->hasher(element);
+  const size_t slot = Find(set, element, hash);
+  if (slot != NotFound) {
+    return ElementAt(set, slot);
+  }
+  if (set->overflow.size == 0) {
+    return NULL;
+  }
+  return HashSetGetWithHash(&set->overflow, element, hash);
+}
+
+CuckooSet CuckooSetNew(size_t count, Hasher* hasher, Comparator* comparator) {
+  size_t buckets = 1;
+  while (buckets < count) {
+    buckets *= 2;
+  }
+  // `CallocHuge` aligns the buckets to cache lines, which they fill exactly.
+  CuckooSet set = {.count = buckets,
+                   .buckets = CallocHuge(buckets, sizeof(CuckooBucket)),
+                   .random = 0x9e3779b97f4a7c15,
+                   .overflow = HashSetNew(1, hasher, comparator),
+                   .hasher = hasher,
+                   .comparator = comparator};
+  return set;
+}
+
+void CuckooSetRemove(CuckooSet* set, const void* element) {
+  const size_t hash = set->hasher(element);
+  const size_t slot = Find(set, element, hash);
+  if (slot == NotFound) {
+    const size_t size = set->overflow.size;
+    HashSetRemoveWithHash(&set->overflow, element, hash);
+    set->size -= size - set->overflow.size;
+    return;
+  }
+  if (slot >= StashSlot(set, 0)) {
+    const size_t i = slot - StashSlot(set, 0);
+    set->stash_size--;
+    set->stash[i] = set->stash[set->stash_size];
+    set->stash_hashes[i] = set->stash_hashes[set->stash_size];
+  } else {
+    CuckooBucket* bucket = &set->buckets[slot / CuckooSlots];
+    bucket->elements[slot % CuckooSlots] = NULL;
+    bucket->hashes[slot % CuckooSlots] = 0;
+  }
+  set->size--;
+}
+
+CuckooSetIterator CuckooSetIteratorNew(const CuckooSet* set) {
+  return (CuckooSetIterator){
+      .slot = 0, .overflow = HashSetIteratorNew(&set->overflow), .set = set};
+}
+
+void* CuckooSetIteratorNext(CuckooSetIterator* i) {
+  const CuckooSet* set = i->set;
+  while (i->slot < StashSlot(set, set->stash_size)) {
+    void* element = ElementAt(set, i->slot++);
+    if (element) {
+      return element;
+    }
+  }
+  return HashSetIteratorNext(&i->overflow);
+}
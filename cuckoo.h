@@ -0,0 +1,98 @@
+// Copyright 2023 Chris Palmer, https://noncombatant.org/
+// SPDX-License-Identifier: Apache-2.0
+
+#ifndef CUCKOO_H
+#define CUCKOO_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "hashset.h"
+
+// A set with the same interface as `HashSet`, but using bucketized cuckoo
+// hashing instead of lists. It’s for callers that need a bound on the
+// worst-case lookup time: a lookup reads at most 2 buckets, each 1 cache line
+// long (plus the small stash, which is almost always empty), unless the
+// `Hasher` is bad (see below).
+//
+// Each element can live in only 2 buckets, determined by its hash. When both
+// are full, adding an element evicts another from one of them, which moves to
+// its other bucket, possibly evicting another, and so on. If that goes on too
+// long, the last evicted element goes into the stash. If the stash is full, the
+// set doubles in size.
+//
+// The set stores each element’s hash, so that lookups call the `Comparator`
+// only for elements whose hashes match, and so that moving elements never calls
+// the `Hasher`.
+//
+// Cuckoo hashing needs a good `Hasher`. If it gives too many elements the same
+// buckets (for example, more than `2 * CuckooSlots + CuckooStashSize` the same
+// hash), there is nowhere to put them, no matter how large the set grows. The
+// set then keeps those elements in an ordinary `HashSet`, the overflow set,
+// and lookups of elements not found in their buckets also check it. It grows
+// only when it is at least half full, so a bad `Hasher` cannot make it grow
+// without bound.
+
+enum { CuckooSlots = 4, CuckooStashSize = 8 };
+
+typedef struct CuckooBucket {
+  size_t hashes[CuckooSlots];
+  // Empty slots are `NULL`.
+  void* elements[CuckooSlots];
+} CuckooBucket;
+
+typedef struct CuckooSet {
+  // The number of buckets. Always a power of 2.
+  size_t count;
+  // The number of elements, including those in the stash.
+  size_t size;
+  CuckooBucket* buckets;
+  size_t stash_size;
+  size_t stash_hashes[CuckooStashSize];
+  void* stash[CuckooStashSize];
+  // The state of the random number generator that chooses which element to
+  // evict.
+  size_t random;
+  // Elements for which there was no room in their buckets or the stash.
+  // Usually empty.
+  HashSet overflow;
+  Hasher* hasher;
+  Comparator* comparator;
+} CuckooSet;
+
+void CuckooSetAdd(CuckooSet* set, void* element);
+
+bool CuckooSetContains(const CuckooSet* set, const void* element);
+
+// `free`s the `CuckooSet`’s internal storage, but not the elements. The caller
+// owns the elements.
+void CuckooSetDelete(CuckooSet* set);
+
+// Returns the element in `set` matching the key part of `element`, or `NULL` if
+// no matching element is present.
+void* CuckooSetGet(const CuckooSet* set, const void* element);
+
+// Returns a new `CuckooSet` with at least `count` buckets, each of which holds
+// `CuckooSlots` elements.
+CuckooSet CuckooSetNew(size_t count, Hasher* hasher, Comparator* comparator);
+
+// Removes from `set` the element matching the key part of `element`, if one is
+// present.
+void CuckooSetRemove(CuckooSet* set, const void* element);
+
+typedef struct CuckooSetIterator {
+  // The index of the next slot to visit, counting all the buckets’ slots and
+  // then the stash.
+  size_t slot;
+  // Visits the overflow set after the slots.
+  HashSetIterator overflow;
+  const CuckooSet* set;
+} CuckooSetIterator;
+
+// Returns a `CuckooSetIterator` that starts at the beginning of `set`.
+CuckooSetIterator CuckooSetIteratorNew(const CuckooSet* set);
+
+// Returns the next element, or `NULL` if iteration has ended.
+void* CuckooSetIteratorNext(CuckooSetIterator* i);
+
+#endif
@@ -0,0 +1,202 @@
+// Copyright 2023 Chris Palmer, https://noncombatant.org/
+// SPDX-License-Identifier: Apache-2.0
+
+#include <stdlib.h>
+
+#include "frozen.h"
+#include "util.h"
+
+// The average number of elements per group. Larger groups need fewer pilots,
+// but it takes longer to find pilots for them.
+enum { ElementsPerGroup = 4 };
+
+// We hash elements to `slot_count` slots, which is slightly more than `size`:
+// it is much easier to find pilots for the last few groups if there are always
+// a few free slots left.
+static size_t SlotCount(size_t size) {
+  return size + size / 32 + 1;
+}
+
+static size_t Group(const FrozenHashSet* set, size_t mixed) {
+  return mixed % set->group_count;
+}
+
+static size_t Position(const FrozenHashSet* set, size_t mixed, size_t pilot) {
+  return MixHash(mixed ^ MixHash(pilot + 1)) % set->slot_count;
+}
+
+typedef struct Key {
+  size_t hash;
+  // `MixHash(hash)`.
+  size_t mixed;
+  void* element;
+} Key;
+
+// Returns true if `pilot` places all `count` `keys` of a group in distinct
+// slots that are not yet `taken`, storing their `positions`.
+static bool TryPilot(const FrozenHashSet* set,
+                     const Key* keys,
+                     size_t count,
+                     size_t pilot,
+                     const bool* taken,
+                     size_t* positions) {
+  for (size_t i = 0; i < count; i++) {
+    const size_t p = Position(set, keys[i].mixed, pilot);
+    if (taken[p]) {
+      return false;
+    }
+    for (size_t j = 0; j < i; j++) {
+      if (positions[j] == p) {
+        return false;
+      }
+    }
+    positions[i] = p;
+  }
+  return true;
+}
+
+typedef struct GroupSize {
+  size_t group;
+  size_t size;
+} GroupSize;
+
+// Sorts `GroupSize`s by decreasing size: the biggest groups are the hardest to
+// place, so we place them first, while most slots are still free.
+static int CompareGroupSizes(const void* a, const void* b) {
+  const GroupSize* g1 = a;
+  const GroupSize* g2 = b;
+  if (g1->size > g2->size) {
+    return -1;
+  } else if (g1->size < g2->size) {
+    return 1;
+  }
+  return 0;
+}
+
+FrozenHashSet HashSetFreeze(const HashSet* set) {
+  // `set->size` includes any expired elements not yet reaped, which the
+  // iterator skips, so count the elements it actually visits.
+  Key* unsorted = calloc(set->size + 1, sizeof(Key));
+  // A range iterator, because freezing is not an iteration for a trace.
+  HashSetIterator it = HashSetIteratorNewRange(set, 0, set->count);
+  void* element;
+  size_t n = 0;
+  while ((element = HashSetIteratorNext(&it))) {
+    const size_t hash = set->hasher(element);
+    unsorted[n++] =
+        (Key){.hash = hash, .mixed = MixHash(hash), .element = element};
+  }
+
+  FrozenHashSet frozen = {
+      .size = n,
+      .group_count = n / ElementsPerGroup + 1,
+      .slot_count = SlotCount(n),
+      .overflow = HashSetNew(1, set->hasher, set->comparator),
+      .hasher = set->hasher,
+      .comparator = set->comparator};
+  frozen.pilots = calloc(frozen.group_count, sizeof(uint16_t));
+  frozen.remap = calloc(frozen.slot_count - n, sizeof(size_t));
+  frozen.elements = calloc(n, sizeof(void*));
+
+  // Sort the elements by group.
+  size_t* starts = calloc(frozen.group_count + 1, sizeof(size_t));
+  for (size_t i = 0; i < n; i++) {
+    starts[Group(&frozen, unsorted[i].mixed) + 1]++;
+  }
+  GroupSize* groups = calloc(frozen.group_count, sizeof(GroupSize));
+  size_t largest = 0;
+  for (size_t g = 0; g < frozen.group_count; g++) {
+    groups[g] = (GroupSize){.group = g, .size = starts[g + 1]};
+    largest = groups[g].size > largest ? groups[g].size : largest;
+    starts[g + 1] += starts[g];
+  }
+  Key* keys = calloc(n, sizeof(Key));
+  size_t* next = calloc(frozen.group_count, sizeof(size_t));
+  for (size_t i = 0; i < n; i++) {
+    const size_t g = Group(&frozen, unsorted[i].mixed);
+    keys[starts[g] + next[g]++] = unsorted[i];
+  }
+  free(next);
+  free(unsorted);
+  qsort(groups, frozen.group_count, sizeof(GroupSize), CompareGroupSizes);
+
+  // Find a pilot for each group.
+  bool* taken = calloc(frozen.slot_count, sizeof(bool));
+  void** slots = calloc(frozen.slot_count, sizeof(void*));
+  size_t* positions = calloc(largest, sizeof(size_t));
+  for (size_t i = 0; i < frozen.group_count && groups[i].size > 0; i++) {
+    const size_t g = groups[i].group;
+    const Key* group = &keys[starts[g]];
+    size_t pilot = 0;
+    while (pilot <= UINT16_MAX &&
+           !TryPilot(&frozen, group, groups[i].size, pilot, taken, positions)) {
+      pilot++;
+    }
+    if (pilot > UINT16_MAX) {
+      for (size_t j = 0; j < groups[i].size; j++) {
+        HashSetAddWithHash(&frozen.overflow, group[j].element, group[j].hash);
+      }
+      continue;
+    }
+    frozen.pilots[g] = (uint16_t)pilot;
+    for (size_t j = 0; j < groups[i].size; j++) {
+      taken[positions[j]] = true;
+      slots[positions[j]] = group[j].element;
+    }
+  }
+
+  // Make the function minimal: move the elements in slots `n` and up into the
+  // free slots below `n`.
+  for (size_t p = 0; p < n; p++) {
+    frozen.elements[p] = slots[p];
+  }
+  size_t free_slot = 0;
+  for (size_t p = n; p < frozen.slot_count; p++) {
+    if (taken[p]) {
+      while (taken[free_slot]) {
+        free_slot++;
+      }
+      frozen.elements[free_slot] = slots[p];
+      frozen.remap[p - n] = free_slot;
+      free_slot++;
+    }
+  }
+
+  free(positions);
+  free(slots);
+  free(taken);
+  free(groups);
+  free(keys);
+  free(starts);
+  return frozen;
+}
+
+bool FrozenHashSetContains(const FrozenHashSet* set, const void* element) {
+  return FrozenHashSetGet(set, element) != NULL;
+}
+
+void FrozenHashSetDelete(FrozenHashSet* set) {
+  free(set->pilots);
+  free(set->remap);
+  free(set->elements);
+  HashSetDelete(&set->overflow);
+}
+
+void* FrozenHashSetGet(const FrozenHashSet* set, const void* element) {
+  const size_t hash = set->hasher(element);
+  if (set->size > 0) {
+    const size_t mixed = MixHash(hash);
+    size_t slot = Position(set, mixed, set->pilots[Group(set, mixed)]);
+    if (slot >= set->size) {
+      slot = set->remap[slot - set->size];
+    }
+    void* candidate = set->elements[slot];
+    if (candidate && set->comparator(candidate, element) == 0) {
+      return candidate;
+    }
+  }
+  if (set->overflow.size == 0) {
+    return NULL;
+  }
+  return HashSetGetWithHash(&set->overflow, element, hash);
+}
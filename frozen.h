@@ -0,0 +1,60 @@
+// Copyright 2023 Chris Palmer, https://noncombatant.org/
+// SPDX-License-Identifier: Apache-2.0
+
+#ifndef FROZEN_H
+#define FROZEN_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "hashset.h"
+
+// An immutable set, built once from a `HashSet` and then only queried.
+//
+// A `FrozenHashSet` uses a minimal perfect hash function: a function that maps
+// each of its `size` elements to a distinct slot in an array of exactly `size`
+// slots. So, a lookup hashes the element, reads 1 slot, and calls the
+// `Comparator` once — there are no lists to walk.
+//
+// The function is built in the style of CHD and PTHash: elements are divided
+// into small groups, and each group gets a 16-bit “pilot” chosen so that its
+// elements land in free slots. With the remapping of the few slots past the end
+// (see `remap`), that costs about 6 bits per element.
+//
+// If 2 elements have the same hash, no pilot can separate them, so they go in a
+// small ordinary `HashSet` (`overflow`) instead. With a good `Hasher`, this is
+// almost always empty.
+typedef struct FrozenHashSet {
+  // The number of elements (and slots).
+  size_t size;
+  // The number of groups (and pilots).
+  size_t group_count;
+  uint16_t* pilots;
+  // The number of slots in which the perfect hash function places elements,
+  // which is slightly more than `size`.
+  size_t slot_count;
+  // Slots `size` and up are remapped into the free slots below `size`.
+  size_t* remap;
+  void** elements;
+  HashSet overflow;
+  Hasher* hasher;
+  Comparator* comparator;
+} FrozenHashSet;
+
+bool FrozenHashSetContains(const FrozenHashSet* set, const void* element);
+
+// `free`s the `FrozenHashSet`’s internal storage, but not the elements. The
+// caller owns the elements.
+void FrozenHashSetDelete(FrozenHashSet* set);
+
+// Returns the element in `set` matching the key part of `element`, or `NULL` if
+// no matching element is present.
+void* FrozenHashSetGet(const FrozenHashSet* set, const void* element);
+
+// Returns a `FrozenHashSet` with the same elements, `Hasher`, and `Comparator`
+// as `set` (less any that have expired). `set` is unchanged, and the caller may
+// delete it.
+FrozenHashSet HashSetFreeze(const HashSet* set);
+
+#endif
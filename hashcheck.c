@@ -0,0 +1,568 @@
+// Copyright 2023 Chris Palmer, https://noncombatant.org/
+// SPDX-License-Identifier: Apache-2.0
+
+// Checks the quality of `Hasher`s. `./hashcheck` checks all the `Hasher`s in
+// `Hashers` against all the key corpora; `./hashcheck NAME...` checks only the
+// named ones.
+//
+// An argument of the form `PATH:SYMBOL` loads the `Hasher` named `SYMBOL` from
+// the shared object at `PATH`, and checks it against the text corpora, whose
+// elements are `NUL`-terminated strings. `PATH:SYMBOL:binary` checks it against
+// the binary corpora instead, whose elements are `BinaryKey`s.
+//
+// Options:
+//
+//   -m       Also print an avalanche matrix for each check.
+//   -w PATH  Read the words corpus from `PATH` (1 word per line) instead of
+//            /usr/share/dict/words. If that can’t be read, hashcheck makes up
+//            words.
+//
+// For each `Hasher` and corpus, it reports:
+//
+// * The chi-square statistic of the bucket lengths against the Poisson
+//   distribution that a uniform hash would give, when choosing 1 of `N` buckets
+//   with `%` (as `HashSet` does) and 1 of a power of 2 with a mask. The mask
+//   sees the raw hashes; `CuckooSet` and `RobinHoodSet` apply `MixHash` first,
+//   which the `MixHash` row shows. Divided by its degrees of freedom, it should
+//   be near 1. Much larger values mean lopsided buckets (or, for sequential
+//   keys and an identity hash, suspiciously even ones).
+// * The bias of each bit: how far from 1/2 is the fraction of keys whose hashes
+//   set it. Random noise is about 1/(2√N).
+// * Avalanche: how far from 1/2 is the probability that flipping each bit of
+//   a key flips each bit of its hash. A `Hasher` that is only used with `%` or
+//   a mask need not avalanche, but then its low bits must be good.
+// * Collisions among the low bits of the hashes, which are all that a mask
+//   sees, compared with what random bits would give.
+// * Predicted probe lengths: the mean number of elements that a successful
+//   lookup compares in a `HashSet` with 1 bucket per key, and the mean and
+//   maximum probe lengths for linear probing with a mask, at load ≤ 1/2.
+
+#include <dlfcn.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hashset.h"
+#include "util.h"
+
+enum {
+  // The number of keys in each made-up corpus.
+  CorpusSize = 100000,
+  // The number of keys whose bits the avalanche check flips.
+  AvalancheSamples = 2000,
+  // The avalanche check flips all the bits of a `BinaryKey`, or the low 7 bits
+  // of each of the first 16 bytes of a string.
+  InputBits = 128,
+  // Hashes are treated as 64 bits wide.
+  OutputBits = 64,
+};
+
+// The elements of the binary corpora. Keys narrower than 128 bits leave
+// `words[1]` 0.
+typedef struct BinaryKey {
+  uint64_t words[2];
+} BinaryKey;
+
+typedef struct Corpus {
+  const char* name;
+  size_t count;
+  // The keys as `BinaryKey`s, or `NULL` if the corpus has no binary form.
+  BinaryKey* binary;
+  // The keys as strings, or `NULL` if the corpus has no text form.
+  char** text;
+} Corpus;
+
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wpadded"
+typedef struct NamedHasher {
+  const char* name;
+  Hasher* hasher;
+  // Whether `hasher` takes `BinaryKey`s, rather than strings.
+  bool binary;
+} NamedHasher;
+#pragma clang diagnostic pop
+
+static size_t MixedStringHash(const void* key) {
+  return MixHash(StringHash(key));
+}
+
+// Returns the key unchanged, as many `Hasher`s for integer keys do (e.g.
+// `RecordHash` in benchmark.c).
+static size_t IdentityHash(const void* key) {
+  const BinaryKey* k = key;
+  return (size_t)(k->words[0] ^ k->words[1]);
+}
+
+static size_t MixedHash(const void* key) {
+  const BinaryKey* k = key;
+  return MixHash((size_t)k->words[0] ^ MixHash((size_t)k->words[1]));
+}
+
+static const NamedHasher Hashers[] = {
+    {.name = "StringHash", .hasher = StringHash},
+    {.name = "MixedStringHash", .hasher = MixedStringHash},
+    {.name = "IdentityHash", .hasher = IdentityHash, .binary = true},
+    {.name = "MixHash", .hasher = MixedHash, .binary = true},
+};
+
+// Returns a corpus of `count` keys, with room for both forms.
+static Corpus CorpusNew(const char* name, size_t count) {
+  return (Corpus){.name = name,
+                  .count = count,
+                  .binary = calloc(count, sizeof(BinaryKey)),
+                  .text = calloc(count, sizeof(char*))};
+}
+
+static void CorpusDelete(Corpus* corpus) {
+  for (size_t i = 0; corpus->text && i < corpus->count; i++) {
+    free(corpus->text[i]);
+  }
+  free(corpus->text);
+  free(corpus->binary);
+}
+
+// Returns the sequential integers from 0.
+static Corpus NewIntegers(void) {
+  Corpus c = CorpusNew("integers", CorpusSize);
+  char buffer[32];
+  for (size_t i = 0; i < c.count; i++) {
+    c.binary[i] = (BinaryKey){.words = {i, 0}};
+    snprintf(buffer, sizeof(buffer), "%zu", i);
+    c.text[i] = strdup(buffer);
+  }
+  return c;
+}
+
+// Returns random (version 4) UUIDs.
+static Corpus NewUUIDs(void) {
+  Corpus c = CorpusNew("UUIDs", CorpusSize);
+  char buffer[40];
+  for (size_t i = 0; i < c.count; i++) {
+    // Treating the UUID’s bytes as 2 big-endian words, the version is bits
+    // 12–15 of the first, and the variant is the top 2 bits of the second.
+    const uint64_t high = (MixHash(2 * i) & ~UINT64_C(0xf000)) | 0x4000;
+    const uint64_t low =
+        (MixHash(2 * i + 1) & ~(UINT64_C(3) << 62)) | UINT64_C(2) << 62;
+    c.binary[i] = (BinaryKey){.words = {high, low}};
+    snprintf(buffer, sizeof(buffer), "%08llx-%04llx-%04llx-%04llx-%012llx",
+             (unsigned long long)(high >> 32),
+             (unsigned long long)(high >> 16 & 0xffff),
+             (unsigned long long)(high & 0xffff),
+             (unsigned long long)(low >> 48),
+             (unsigned long long)(low & 0xffffffffffff));
+    c.text[i] = strdup(buffer);
+  }
+  return c;
+}
+
+// Returns (device, inode) pairs like those of a few busy file systems: a
+// handful of devices, each with densely-numbered inodes.
+static Corpus NewFileIDs(void) {
+  Corpus c = CorpusNew("file IDs", CorpusSize);
+  char buffer[48];
+  for (size_t i = 0; i < c.count; i++) {
+    const uint64_t device = 0xfd00 + i % 4;
+    const uint64_t inode = 2 + i / 4;
+    c.binary[i] = (BinaryKey){.words = {device, inode}};
+    snprintf(buffer, sizeof(buffer), "%llu:%llu", (unsigned long long)device,
+             (unsigned long long)inode);
+    c.text[i] = strdup(buffer);
+  }
+  return c;
+}
+
+// Returns the distinct words in the file at `path`, or made-up words if it
+// can’t be read.
+static Corpus NewWords(const char* path) {
+  HashSet words = HashSetNew(CorpusSize, StringHash, (Comparator*)strcmp);
+  const char* name = "words";
+  FILE* file = fopen(path, "r");
+  if (file) {
+    char* line = NULL;
+    size_t capacity = 0;
+    ssize_t length;
+    while ((length = getline(&line, &capacity, file)) > 0) {
+      if (line[length - 1] == '\n') {
+        line[length - 1] = '\0';
+      }
+      if (line[0] != '\0' && !HashSetContains(&words, line)) {
+        HashSetAdd(&words, strdup(line));
+      }
+    }
+    free(line);
+    (void)fclose(file);
+  } else {
+    name = "made-up words";
+    char word[16];
+    for (size_t i = 0; words.size < CorpusSize; i++) {
+      const size_t length = 2 + MixHash(i) % 10;
+      for (size_t j = 0; j < length; j++) {
+        word[j] = (char)('a' + MixHash(i * sizeof(word) + j + 1) % 26);
+      }
+      word[length] = '\0';
+      if (!HashSetContains(&words, word)) {
+        HashSetAdd(&words, strdup(word));
+      }
+    }
+  }
+
+  Corpus c = {.name = name,
+              .count = words.size,
+              .text = calloc(words.size, sizeof(char*))};
+  HashSetIterator it = HashSetIteratorNew(&words);
+  for (size_t i = 0; i < c.count; i++) {
+    c.text[i] = HashSetIteratorNext(&it);
+  }
+  HashSetDelete(&words);
+  return c;
+}
+
+// Returns the smallest power of 2 that is at least `n`.
+static size_t PowerOf2(size_t n) {
+  size_t p = 1;
+  while (p < n) {
+    p *= 2;
+  }
+  return p;
+}
+
+// Returns the length of each of `buckets` buckets, choosing each key’s bucket
+// with a mask if `masked`, or with `%` otherwise.
+static size_t* BucketLengths(const size_t* hashes,
+                             size_t count,
+                             size_t buckets,
+                             bool masked) {
+  size_t* lengths = calloc(buckets, sizeof(size_t));
+  for (size_t i = 0; i < count; i++) {
+    lengths[masked ? hashes[i] & (buckets - 1) : hashes[i] % buckets]++;
+  }
+  return lengths;
+}
+
+// Returns the chi-square statistic of `lengths` against the Poisson
+// distribution, divided by its degrees of freedom.
+static double ChiSquare(const size_t* lengths, size_t buckets, size_t count) {
+  // Count buckets of length 0 through `Bins - 2`, and the rest together.
+  enum { Bins = 8 };
+  size_t observed[Bins] = {0};
+  for (size_t i = 0; i < buckets; i++) {
+    observed[lengths[i] < Bins - 1 ? lengths[i] : Bins - 1]++;
+  }
+
+  const double mean = (double)count / (double)buckets;
+  double p = exp(-mean);
+  double remaining = 1;
+  double chi_square = 0;
+  for (size_t k = 0; k < Bins; k++) {
+    const double expected =
+        (double)buckets * (k < Bins - 1 ? p : remaining);
+    const double d = (double)observed[k] - expected;
+    chi_square += d * d / expected;
+    remaining -= p;
+    p *= mean / (double)(k + 1);
+  }
+  return chi_square / (Bins - 1);
+}
+
+// Returns the mean number of elements that a successful lookup compares, when
+// each bucket is a list of `lengths[i]` elements.
+static double ChainedProbes(const size_t* lengths,
+                            size_t buckets,
+                            size_t count) {
+  double total = 0;
+  for (size_t i = 0; i < buckets; i++) {
+    total += (double)(lengths[i] * (lengths[i] + 1) / 2);
+  }
+  return total / (double)count;
+}
+
+static void PrintBias(const size_t* hashes, size_t count) {
+  size_t ones[OutputBits] = {0};
+  for (size_t i = 0; i < count; i++) {
+    for (size_t b = 0; b < OutputBits; b++) {
+      ones[b] += hashes[i] >> b & 1;
+    }
+  }
+  double worst = 0;
+  size_t worst_bit = 0;
+  for (size_t b = 0; b < OutputBits; b++) {
+    const double bias = fabs((double)ones[b] / (double)count - 0.5);
+    if (bias > worst) {
+      worst = bias;
+      worst_bit = b;
+    }
+  }
+  printf("  bit bias: worst %.4f (bit %zu); noise %.4f\n", worst, worst_bit,
+         0.5 / sqrt((double)count));
+}
+
+// Counts, in `flips`, which bits differ between `a` and `b`.
+static void Tally(size_t* flips, size_t a, size_t b) {
+  const size_t d = a ^ b;
+  for (size_t j = 0; j < OutputBits; j++) {
+    flips[j] += d >> j & 1;
+  }
+}
+
+static void PrintAvalanche(const NamedHasher* h,
+                           const Corpus* c,
+                           bool matrix) {
+  static size_t flips[InputBits][OutputBits];
+  static size_t trials[InputBits];
+  memset(flips, 0, sizeof(flips));
+  memset(trials, 0, sizeof(trials));
+
+  const size_t step = c->count > AvalancheSamples ? c->count / AvalancheSamples
+                                                  : 1;
+  for (size_t i = 0; i < c->count; i += step) {
+    if (h->binary) {
+      BinaryKey k = c->binary[i];
+      const size_t hash = h->hasher(&k);
+      for (size_t bit = 0; bit < InputBits; bit++) {
+        const uint64_t flip = UINT64_C(1) << bit % 64;
+        k.words[bit / 64] ^= flip;
+        Tally(flips[bit], hash, h->hasher(&k));
+        k.words[bit / 64] ^= flip;
+        trials[bit]++;
+      }
+      continue;
+    }
+
+    char k[256];
+    const size_t length = strlen(c->text[i]);
+    if (length >= sizeof(k)) {
+      continue;
+    }
+    memcpy(k, c->text[i], length + 1);
+    const size_t hash = h->hasher(k);
+    for (size_t bit = 0; bit < InputBits && bit / 8 < length; bit++) {
+      const char flip = (char)(1 << bit % 8);
+      // Keep the string’s length, and the character’s high bit.
+      if (bit % 8 == 7 || (k[bit / 8] ^ flip) == '\0') {
+        continue;
+      }
+      k[bit / 8] ^= flip;
+      Tally(flips[bit], hash, h->hasher(k));
+      k[bit / 8] ^= flip;
+      trials[bit]++;
+    }
+  }
+
+  double total = 0;
+  size_t cells = 0;
+  double worst = 0;
+  size_t worst_in = 0;
+  size_t worst_out = 0;
+  for (size_t i = 0; i < InputBits; i++) {
+    for (size_t j = 0; trials[i] && j < OutputBits; j++) {
+      const double bias =
+          fabs((double)flips[i][j] / (double)trials[i] - 0.5);
+      total += bias;
+      cells++;
+      if (bias > worst) {
+        worst = bias;
+        worst_in = i;
+        worst_out = j;
+      }
+    }
+  }
+  printf("  avalanche bias: mean %.3f, worst %.3f "
+         "(key bit %zu, hash bit %zu)\n",
+         total / (double)cells, worst, worst_in, worst_out);
+  if (!matrix) {
+    return;
+  }
+
+  // 1 row per key byte, and 1 column per hash bit (from bit 0), showing the
+  // worst bias of the byte’s bits, from ' ' (none) to '@' (0.5).
+  static const char shades[] = " .:-=+*#%@";
+  printf("  avalanche matrix (rows: key bytes; columns: hash bits 0–63):\n");
+  for (size_t byte = 0; byte < InputBits / 8; byte++) {
+    char row[OutputBits + 1] = {0};
+    bool any = false;
+    for (size_t j = 0; j < OutputBits; j++) {
+      double bias = 0;
+      for (size_t i = byte * 8; i < byte * 8 + 8; i++) {
+        if (trials[i]) {
+          any = true;
+          bias = fmax(bias,
+                      fabs((double)flips[i][j] / (double)trials[i] - 0.5));
+        }
+      }
+      const size_t shade = (size_t)(bias * 2 * (sizeof(shades) - 2) + 0.5);
+      row[j] = shades[shade];
+    }
+    if (any) {
+      printf("    %2zu |%s|\n", byte, row);
+    }
+  }
+}
+
+static int CompareSize(const void* a, const void* b) {
+  const size_t* x = a;
+  const size_t* y = b;
+  if (*x < *y) {
+    return -1;
+  } else if (*x > *y) {
+    return 1;
+  }
+  return 0;
+}
+
+static void PrintCollisions(const size_t* hashes,
+                            size_t count,
+                            size_t mask_bits) {
+  printf("  collisions:");
+  const size_t widths[] = {mask_bits - 4, mask_bits, mask_bits + 4};
+  for (size_t w = 0; w < COUNT(widths); w++) {
+    const size_t buckets = (size_t)1 << widths[w];
+    uint8_t* seen = calloc(buckets, 1);
+    size_t distinct = 0;
+    for (size_t i = 0; i < count; i++) {
+      uint8_t* s = &seen[hashes[i] & (buckets - 1)];
+      distinct += !*s;
+      *s = 1;
+    }
+    free(seen);
+    const double expected =
+        (double)count -
+        (double)buckets *
+            (1 - pow(1 - 1 / (double)buckets, (double)count));
+    printf(" low %zu bits %zu (random %.0f);", widths[w], count - distinct,
+           expected);
+  }
+
+  size_t* sorted = CopyNew(hashes, count * sizeof(size_t));
+  qsort(sorted, count, sizeof(size_t), CompareSize);
+  size_t duplicates = 0;
+  for (size_t i = 1; i < count; i++) {
+    duplicates += sorted[i] == sorted[i - 1];
+  }
+  free(sorted);
+  printf(" all bits %zu\n", duplicates);
+}
+
+// Prints the probe lengths of linear probing into a table with a mask, at load
+// at most 1/2.
+static void PrintLinearProbes(const size_t* hashes, size_t count) {
+  const size_t size = 2 * PowerOf2(count);
+  bool* used = calloc(size, sizeof(bool));
+  size_t total = 0;
+  size_t longest = 0;
+  for (size_t i = 0; i < count; i++) {
+    size_t j = hashes[i] & (size - 1);
+    size_t probes = 1;
+    while (used[j]) {
+      j = (j + 1) & (size - 1);
+      probes++;
+    }
+    used[j] = true;
+    total += probes;
+    longest = probes > longest ? probes : longest;
+  }
+  free(used);
+
+  // Knuth’s estimate for a successful search.
+  const double load = (double)count / (double)size;
+  printf("  linear probes: mean %.2f (random %.2f), max %zu\n",
+         (double)total / (double)count, (1 + 1 / (1 - load)) / 2, longest);
+}
+
+static void Check(const NamedHasher* h, const Corpus* c, bool matrix) {
+  if ((h->binary && c->binary == NULL) || (!h->binary && c->text == NULL)) {
+    return;
+  }
+  const size_t count = c->count;
+  size_t* hashes = malloc(count * sizeof(size_t));
+  for (size_t i = 0; i < count; i++) {
+    hashes[i] =
+        h->hasher(h->binary ? (const void*)&c->binary[i] : c->text[i]);
+  }
+  printf("%s, %s (%zu keys)\n", h->name, c->name, count);
+
+  const size_t masked = PowerOf2(count);
+  size_t* lengths = BucketLengths(hashes, count, count, false);
+  const double chained = ChainedProbes(lengths, count, count);
+  printf("  chi-square/df: %.2f with %% %zu, ",
+         ChiSquare(lengths, count, count), count);
+  free(lengths);
+  lengths = BucketLengths(hashes, count, masked, true);
+  printf("%.2f with & %#zx\n", ChiSquare(lengths, masked, count), masked - 1);
+  free(lengths);
+
+  PrintBias(hashes, count);
+  PrintAvalanche(h, c, matrix);
+  size_t mask_bits = 0;
+  while ((size_t)1 << mask_bits < masked) {
+    mask_bits++;
+  }
+  PrintCollisions(hashes, count, mask_bits < 4 ? 4 : mask_bits);
+  printf("  chained probes: mean %.2f (random 1.50)\n", chained);
+  PrintLinearProbes(hashes, count);
+  free(hashes);
+}
+
+// Loads a `Hasher` named by `argument`, of the form `PATH:SYMBOL` or
+// `PATH:SYMBOL:binary`. Returns false, having printed an error, if it can’t.
+static bool LoadHasher(char* argument, NamedHasher* h) {
+  char* symbol = strchr(argument, ':');
+  *symbol++ = '\0';
+  char* kind = strchr(symbol, ':');
+  if (kind) {
+    *kind++ = '\0';
+  }
+  void* library = dlopen(argument, RTLD_NOW);
+  void* hasher = library ? dlsym(library, symbol) : NULL;
+  if (hasher == NULL) {
+    fprintf(stderr, "hashcheck: %s\n", dlerror());
+    return false;
+  }
+  *h = (NamedHasher){.name = symbol,
+                     .binary = kind && StringEquals(kind, "binary")};
+  // POSIX guarantees that this works, although C does not.
+  memcpy(&h->hasher, &hasher, sizeof(h->hasher));
+  return true;
+}
+
+int main(int count, char* arguments[]) {
+  bool matrix = false;
+  const char* words = "/usr/share/dict/words";
+  NamedHasher* hashers = calloc((size_t)count, sizeof(NamedHasher));
+  size_t hasher_count = 0;
+  for (int i = 1; i < count; i++) {
+    if (StringEquals(arguments[i], "-m")) {
+      matrix = true;
+    } else if (StringEquals(arguments[i], "-w") && i + 1 < count) {
+      words = arguments[++i];
+    } else if (strchr(arguments[i], ':')) {
+      if (!LoadHasher(arguments[i], &hashers[hasher_count++])) {
+        return EXIT_FAILURE;
+      }
+    } else {
+      size_t j = 0;
+      while (j < COUNT(Hashers) &&
+             !StringEquals(arguments[i], Hashers[j].name)) {
+        j++;
+      }
+      if (j == COUNT(Hashers)) {
+        fprintf(stderr, "hashcheck: no Hasher named %s\n", arguments[i]);
+        return EXIT_FAILURE;
+      }
+      hashers[hasher_count++] = Hashers[j];
+    }
+  }
+
+  Corpus corpora[] = {NewIntegers(), NewWords(words), NewUUIDs(),
+                      NewFileIDs()};
+  for (size_t i = 0; i < (hasher_count ? hasher_count : COUNT(Hashers)); i++) {
+    for (size_t j = 0; j < COUNT(corpora); j++) {
+      Check(hasher_count ? &hashers[i] : &Hashers[i], &corpora[j], matrix);
+    }
+  }
+  for (size_t j = 0; j < COUNT(corpora); j++) {
+    CorpusDelete(&corpora[j]);
+  }
+  free(hashers);
+}
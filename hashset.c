@@ -1,6 +1,8 @@
 // Copyright 2023 Chris Palmer, https://noncombatant.org/
 // SPDX-License-Identifier: Apache-2.0
 
+#include <stdatomic.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -28,27 +30,635 @@
 //   return size;
 // }
 
-void HashSetAdd(HashSet* set, void* element) {
-  const size_t hash = set->hasher(element) % set->count;
-  HashSetElements* es = set->elements[hash];
-  if (es == NULL) {
-    set->elements[hash] = malloc(sizeof(HashSetElements));
-    set->elements[hash]->element = element;
-    set->elements[hash]->next = NULL;
+// The filter is a split-block Bloom filter, as in Apache Parquet: each element
+// sets 1 bit in each of the 8 words of 1 cache line-sized block.
+
+enum { FilterBlockWords = 8 };
+
+// The filter is sized to have this many bits per element. This gives a false
+// positive rate of about 0.1%.
+enum { FilterBitsPerElement = 16 };
+
+// Returns the block for `hash` in `set->filter`, and fills `masks` with the bit
+// to test or set in each of its words.
+static uint64_t* FilterBlock(const HashSet* set,
+                             size_t hash,
+                             uint64_t masks[FilterBlockWords]) {
+  static const uint32_t salts[FilterBlockWords] = {
+      0x47b6137b, 0x44974d91, 0x8824ad5b, 0xa2b7289d,
+      0x705495c7, 0x2df1424b, 0x9efc4947, 0x5c6bfb31};
+  // Use the low bits to select the block, and the high bits to select the bits
+  // in it. (`MixHash` because many `Hasher`s have poor high bits.)
+  const uint64_t mixed = MixHash(hash);
+  const uint32_t h = (uint32_t)(mixed >> 32);
+  for (size_t i = 0; i < FilterBlockWords; i++) {
+    masks[i] = UINT64_C(1) << ((uint32_t)(h * salts[i]) >> 26);
+  }
+  return &set->filter[(mixed % set->filter_blocks) * FilterBlockWords];
+}
+
+static void FilterAdd(HashSet* set, size_t hash) {
+  uint64_t masks[FilterBlockWords];
+  uint64_t* block = FilterBlock(set, hash, masks);
+  for (size_t i = 0; i < FilterBlockWords; i++) {
+    block[i] |= masks[i];
+  }
+}
+
+static bool FilterMayContain(const HashSet* set, size_t hash) {
+  uint64_t masks[FilterBlockWords];
+  const uint64_t* block = FilterBlock(set, hash, masks);
+  for (size_t i = 0; i < FilterBlockWords; i++) {
+    if ((block[i] & masks[i]) == 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// With `HashSetTreeify`, a bucket whose list grows longer than
+// `TreeifyThreshold` becomes an AVL tree, ordered by the `Comparator`. (This is
+// what Java’s `HashMap` does, with red-black trees.) A bit in `set->trees`
+// marks each such bucket.
+//
+// Tree nodes begin with a `HashSetElements`, and remain linked in a list (in no
+// particular order), so code that only walks lists — `HashSetIterator`,
+// `HashSetDelete`, and so on — works unchanged. The list is doubly-linked, so
+// that we can keep the root of the tree at the head of the list (and thus in
+// `set->elements`).
+
+enum { TreeifyThreshold = 8 };
+
+typedef struct TreeElements {
+  HashSetElements list;
+  struct TreeElements* previous;
+  struct TreeElements* left;
+  struct TreeElements* right;
+  size_t height;
+} TreeElements;
+
+static bool IsTree(const HashSet* set, size_t bucket) {
+  return set->trees && (set->trees[bucket / 64] >> (bucket % 64)) & 1;
+}
+
+static void SetIsTree(HashSet* set, size_t bucket, bool is_tree) {
+  if (set->trees == NULL) {
+    set->trees = calloc(set->count / 64 + 1, sizeof(uint64_t));
+  }
+  const uint64_t bit = UINT64_C(1) << (bucket % 64);
+  set->trees[bucket / 64] =
+      is_tree ? set->trees[bucket / 64] | bit : set->trees[bucket / 64] & ~bit;
+}
+
+static TreeElements* Root(const HashSet* set, size_t bucket) {
+  return (TreeElements*)set->elements[bucket];
+}
+
+static TreeElements* Next(const TreeElements* node) {
+  return (TreeElements*)node->list.next;
+}
+
+static void Unlink(HashSet* set, size_t bucket, TreeElements* node) {
+  if (node->previous) {
+    node->previous->list.next = node->list.next;
+  } else {
+    set->elements[bucket] = node->list.next;
+  }
+  if (node->list.next) {
+    Next(node)->previous = node->previous;
+  }
+}
+
+// Links `node` into the list of `bucket`, after its head.
+static void LinkAfterRoot(HashSet* set, size_t bucket, TreeElements* node) {
+  TreeElements* root = Root(set, bucket);
+  node->previous = root;
+  node->list.next = root->list.next;
+  if (node->list.next) {
+    Next(node)->previous = node;
+  }
+  root->list.next = &node->list;
+}
+
+static void MoveToFront(HashSet* set, size_t bucket, TreeElements* node) {
+  TreeElements* head = Root(set, bucket);
+  if (head == node) {
     return;
   }
+  Unlink(set, bucket, node);
+  node->previous = NULL;
+  node->list.next = &head->list;
+  head->previous = node;
+  set->elements[bucket] = &node->list;
+}
+
+static size_t Height(const TreeElements* node) {
+  return node ? node->height : 0;
+}
+
+static void UpdateHeight(TreeElements* node) {
+  const size_t left = Height(node->left);
+  const size_t right = Height(node->right);
+  node->height = (left > right ? left : right) + 1;
+}
+
+static TreeElements* RotateLeft(TreeElements* node) {
+  TreeElements* right = node->right;
+  node->right = right->left;
+  right->left = node;
+  UpdateHeight(node);
+  UpdateHeight(right);
+  return right;
+}
+
+static TreeElements* RotateRight(TreeElements* node) {
+  TreeElements* left = node->left;
+  node->left = left->right;
+  left->right = node;
+  UpdateHeight(node);
+  UpdateHeight(left);
+  return left;
+}
+
+// Restores the AVL balance of the subtree at `node`, whose children are
+// balanced, and returns its new root.
+static TreeElements* Rebalance(TreeElements* node) {
+  UpdateHeight(node);
+  if (Height(node->left) > Height(node->right) + 1) {
+    if (Height(node->left->right) > Height(node->left->left)) {
+      node->left = RotateLeft(node->left);
+    }
+    return RotateRight(node);
+  }
+  if (Height(node->right) > Height(node->left) + 1) {
+    if (Height(node->right->left) > Height(node->right->right)) {
+      node->right = RotateRight(node->right);
+    }
+    return RotateLeft(node);
+  }
+  return node;
+}
+
+// Returns the node in the subtree at `node` matching `key`, according to
+// `compare`, or `NULL`.
+static TreeElements* TreeFind(TreeElements* node,
+                              const void* key,
+                              Comparator* compare) {
+  while (node) {
+    const int c = compare(node->list.element, key);
+    if (c == 0) {
+      return node;
+    }
+    node = c > 0 ? node->left : node->right;
+  }
+  return NULL;
+}
+
+// Inserts `node`, which must not match any element already present, into the
+// subtree at `root`, and returns the subtree’s new root.
+static TreeElements* TreeInsert(const HashSet* set,
+                                TreeElements* root,
+                                TreeElements* node) {
+  if (root == NULL) {
+    node->left = NULL;
+    node->right = NULL;
+    node->height = 1;
+    return node;
+  }
+  if (set->comparator(root->list.element, node->list.element) > 0) {
+    root->left = TreeInsert(set, root->left, node);
+  } else {
+    root->right = TreeInsert(set, root->right, node);
+  }
+  return Rebalance(root);
+}
+
+// Removes the node matching `key`, according to `compare`, from the subtree at
+// `root`, and returns the subtree’s new root. Sets `*removed` to the node that
+// was detached from the tree (which might not be the one that held the
+// matching element).
+static TreeElements* TreeRemove(const HashSet* set,
+                                TreeElements* root,
+                                const void* key,
+                                Comparator* compare,
+                                TreeElements** removed) {
+  if (root == NULL) {
+    return NULL;
+  }
+  const int c = compare(root->list.element, key);
+  if (c > 0) {
+    root->left = TreeRemove(set, root->left, key, compare, removed);
+  } else if (c < 0) {
+    root->right = TreeRemove(set, root->right, key, compare, removed);
+  } else if (root->left && root->right) {
+    // Replace this node’s element with its successor’s, and remove the
+    // successor’s node instead.
+    TreeElements* successor = root->right;
+    while (successor->left) {
+      successor = successor->left;
+    }
+    root->list.element = successor->list.element;
+    root->right = TreeRemove(set, root->right, successor->list.element,
+                             set->comparator, removed);
+  } else {
+    *removed = root;
+    return root->left ? root->left : root->right;
+  }
+  return Rebalance(root);
+}
+
+// Converts the list in `bucket` into a tree.
+static void Treeify(HashSet* set, size_t bucket) {
+  HashSetElements* es = set->elements[bucket];
+  set->elements[bucket] = NULL;
+  TreeElements* root = NULL;
+  TreeElements* last = NULL;
   while (es) {
-    if (set->comparator(es->element, element) == 0) {
-      es->element = element;
-      return;
+    TreeElements* node = malloc(sizeof(TreeElements));
+    node->list = (HashSetElements){.element = es->element, .next = NULL};
+    node->previous = last;
+    if (last) {
+      last->list.next = &node->list;
+    } else {
+      set->elements[bucket] = &node->list;
     }
-    if (es->next == NULL) {
-      es->next = malloc(sizeof(HashSetElements));
-      es->next->element = element;
-      es->next->next = NULL;
+    last = node;
+    root = TreeInsert(set, root, node);
+
+    HashSetElements* next = es->next;
+    free(es);
+    es = next;
+  }
+  SetIsTree(set, bucket, true);
+  MoveToFront(set, bucket, root);
+}
+
+// Appends the elements of the subtree at `node` to `*link`, in order, as plain
+// list nodes. Returns the link after the last one.
+static HashSetElements** AppendInOrder(const TreeElements* node,
+                                       HashSetElements** link) {
+  if (node == NULL) {
+    return link;
+  }
+  link = AppendInOrder(node->left, link);
+  *link = malloc(sizeof(HashSetElements));
+  (*link)->element = node->list.element;
+  (*link)->next = NULL;
+  return AppendInOrder(node->right, &(*link)->next);
+}
+
+// Converts the tree in `bucket` back into a (sorted) list.
+static void Untreeify(HashSet* set, size_t bucket) {
+  TreeElements* node = Root(set, bucket);
+  set->elements[bucket] = NULL;
+  AppendInOrder(node, &set->elements[bucket]);
+  while (node) {
+    TreeElements* next = Next(node);
+    free(node);
+    node = next;
+  }
+  SetIsTree(set, bucket, false);
+}
+
+static HashSetElements* TreeAdd(HashSet* set, size_t bucket, void* element) {
+  TreeElements* found =
+      TreeFind(Root(set, bucket), element, set->comparator);
+  if (found) {
+    found->list.element = element;
+    return &found->list;
+  }
+  TreeElements* node = malloc(sizeof(TreeElements));
+  node->list.element = element;
+  LinkAfterRoot(set, bucket, node);
+  MoveToFront(set, bucket, TreeInsert(set, Root(set, bucket), node));
+  set->size++;
+  return &node->list;
+}
+
+static void TreeRemoveElement(HashSet* set,
+                              size_t bucket,
+                              const void* key,
+                              Comparator* compare) {
+  TreeElements* removed = NULL;
+  TreeElements* root =
+      TreeRemove(set, Root(set, bucket), key, compare, &removed);
+  if (removed == NULL) {
+    return;
+  }
+  Unlink(set, bucket, removed);
+  free(removed);
+  set->size--;
+  if (root) {
+    MoveToFront(set, bucket, root);
+  }
+
+  // Like Java, revert to a list when the tree gets small, judging by its shape
+  // rather than counting its nodes.
+  if (root == NULL || root->left == NULL || root->right == NULL ||
+      root->left->left == NULL) {
+    Untreeify(set, bucket);
+  }
+}
+
+// With `HashSetSmall`, the set is small until it first holds more than
+// `HashSetSmallSize` elements.
+
+static bool IsSmall(const HashSet* set) {
+  return set->elements == NULL;
+}
+
+// Returns the index in `set->small` of the element matching `key`, according to
+// `compare`, or `set->size` if there is none.
+static size_t FindSmall(const HashSet* set,
+                        const void* key,
+                        Comparator* compare) {
+  for (size_t i = 0; i < set->size; i++) {
+    if (compare(set->small[i], key) == 0) {
+      return i;
+    }
+  }
+  return set->size;
+}
+
+// Returns the node in `bucket` holding the element matching `key`, according to
+// `compare`, or `NULL`. To find an element matching the key part of another,
+// pass `set->comparator`.
+static HashSetElements* Find(const HashSet* set,
+                             size_t bucket,
+                             const void* key,
+                             Comparator* compare) {
+  if (IsTree(set, bucket)) {
+    TreeElements* node = TreeFind(Root(set, bucket), key, compare);
+    return node ? &node->list : NULL;
+  }
+  const bool sorted = set->options & HashSetSorted;
+  for (HashSetElements* es = set->elements[bucket]; es; es = es->next) {
+    const int c = compare(es->element, key);
+    if (c == 0) {
+      return es;
+    }
+    if (c > 0 && sorted) {
+      break;
+    }
+  }
+  return NULL;
+}
+
+// Bounded and expiring sets keep extra state in each node.
+typedef struct CachedElements {
+  HashSetElements list;
+  // In a bounded set, whether the element has been used since the clock hand
+  // last passed it.
+  atomic_size_t referenced;
+  // In an expiring set, the time (according to `set->clock`) at which the
+  // element expires.
+  uint64_t expires;
+} CachedElements;
+
+static const uint64_t Never = UINT64_MAX;
+
+static bool IsBounded(const HashSet* set) {
+  return !IsSmall(set) && set->capacity != 0;
+}
+
+static bool IsExpiring(const HashSet* set) {
+  return set->clock != NULL;
+}
+
+static bool IsExpired(const HashSet* set,
+                      const HashSetElements* es,
+                      uint64_t now) {
+  return IsExpiring(set) && ((const CachedElements*)es)->expires <= now;
+}
+
+// Tells `set->tracer`, if there is one, about an operation.
+static void Trace(const HashSet* set,
+                  enum HashSetTraceOperation operation,
+                  const void* element,
+                  size_t hash) {
+  if (set->tracer) {
+    set->tracer(operation, element, hash, set->tracer_context);
+  }
+}
+
+// Returns an iterator over all of `set` that, unlike `HashSetIteratorNew`, is
+// not traced. Use it for passes that are part of another operation.
+static HashSetIterator IteratorNewUntraced(const HashSet* set) {
+  return HashSetIteratorNewRange(set, 0, set->count);
+}
+
+// Removes the node at `*link` from `set`, and passes its element to the
+// `Evictor`. Traces the removal, so that a replay of the trace evicts and reaps
+// the same elements.
+static void Discard(HashSet* set, HashSetElements** link) {
+  HashSetElements* es = *link;
+  *link = es->next;
+  set->size--;
+  void* element = es->element;
+  free(es);
+  if (set->tracer) {
+    Trace(set, HashSetTraceRemove, element, set->hasher(element));
+  }
+  if (set->evictor) {
+    set->evictor(element, set->evictor_context);
+  }
+}
+
+static void Reference(const HashSet* set, HashSetElements* es) {
+  if (IsBounded(set)) {
+    atomic_store_explicit(&((CachedElements*)es)->referenced, 1,
+                          memory_order_relaxed);
+  }
+}
+
+// Discards the expired elements in `bucket`, and returns how many. Lowers
+// `*earliest` to the earliest expiry among the rest.
+static size_t ReapBucket(HashSet* set,
+                         size_t bucket,
+                         uint64_t now,
+                         uint64_t* earliest) {
+  size_t reaped = 0;
+  HashSetElements** link = &set->elements[bucket];
+  for (HashSetElements* es; (es = *link);) {
+    const uint64_t expires = ((const CachedElements*)es)->expires;
+    if (expires <= now) {
+      Discard(set, link);
+      reaped++;
+    } else {
+      if (expires < *earliest) {
+        *earliest = expires;
+      }
+      link = &es->next;
+    }
+  }
+  return reaped;
+}
+
+// Removes an element from a bounded set. If the set expires elements and some
+// may have expired, it reaps the whole set, and if that frees anything, evicts
+// nothing live. Otherwise it uses the CLOCK algorithm: the hand sweeps the
+// buckets in order, giving each referenced element a second chance by clearing
+// its bit, and evicts the first one whose bit is already clear.
+static void Evict(HashSet* set) {
+  if (IsExpiring(set)) {
+    const uint64_t now = set->clock();
+    if (set->earliest_expiry <= now) {
+      uint64_t earliest = Never;
+      size_t reaped = 0;
+      for (size_t i = 0; i < set->count; i++) {
+        reaped += ReapBucket(set, i, now, &earliest);
+      }
+      set->earliest_expiry = earliest;
+      if (reaped) {
+        return;
+      }
+    }
+  }
+  while (true) {
+    HashSetElements** link = &set->elements[set->hand];
+    for (HashSetElements* es; (es = *link);) {
+      CachedElements* c = (CachedElements*)es;
+      if (atomic_exchange_explicit(&c->referenced, 0, memory_order_relaxed)) {
+        link = &es->next;
+        continue;
+      }
+      Discard(set, link);
       return;
     }
-    es = es->next;
+    set->hand = (set->hand + 1) % set->count;
+  }
+}
+
+void HashSetAdd(HashSet* set, void* element) {
+  HashSetAddWithHash(set, element, set->hasher(element));
+}
+
+// Adds `element` to `bucket`, or replaces the matching element. Returns the
+// element’s node.
+static HashSetElements* AddToBucket(HashSet* set,
+                                    size_t bucket,
+                                    void* element) {
+  if (IsTree(set, bucket)) {
+    return TreeAdd(set, bucket, element);
+  }
+  const bool sorted = set->options & HashSetSorted;
+  size_t length = 1;
+  HashSetElements** link = &set->elements[bucket];
+  for (HashSetElements* es; (es = *link); link = &es->next, length++) {
+    const int c = set->comparator(es->element, element);
+    if (c == 0) {
+      es->element = element;
+      Reference(set, es);
+      return es;
+    }
+    if (c > 0 && sorted) {
+      break;
+    }
+  }
+  HashSetElements* added;
+  if (IsBounded(set) || IsExpiring(set)) {
+    CachedElements* c = malloc(sizeof(CachedElements));
+    atomic_init(&c->referenced, 0);
+    c->expires = Never;
+    added = &c->list;
+  } else {
+    added = malloc(sizeof(HashSetElements));
+  }
+  added->element = element;
+  added->next = *link;
+  *link = added;
+  set->size++;
+
+  if (set->options & HashSetTreeify) {
+    for (HashSetElements* es = added->next; es; es = es->next) {
+      length++;
+    }
+    if (length > TreeifyThreshold) {
+      Treeify(set, bucket);
+      return Find(set, bucket, element, set->comparator);
+    }
+  }
+  return added;
+}
+
+// Moves the elements of a small set into newly allocated buckets.
+static void Unsmall(HashSet* set) {
+  void* small[HashSetSmallSize];
+  memcpy(small, set->small, sizeof(small));
+  // The small elements overlap the state of a set with buckets.
+  memset(set->small, 0, sizeof(set->small));
+  set->elements = CallocHuge(set->count, sizeof(HashSetElements*));
+  const size_t size = set->size;
+  set->size = 0;
+  for (size_t i = 0; i < size; i++) {
+    AddToBucket(set, set->hasher(small[i]) % set->count, small[i]);
+  }
+}
+
+// Returns true if `set` has a Bloom filter.
+static bool HasFilter(const HashSet* set) {
+  return !IsSmall(set) && set->filter;
+}
+
+// Adds `element`, and returns its node, or `NULL` if the set is small.
+static HashSetElements* Add(HashSet* set, void* element, size_t hash) {
+  Trace(set, HashSetTraceAdd, element, hash);
+  if (HasFilter(set)) {
+    FilterAdd(set, hash);
+  }
+  if (IsSmall(set)) {
+    const size_t i = FindSmall(set, element, set->comparator);
+    if (i < set->size || set->size < HashSetSmallSize) {
+      set->small[i] = element;
+      if (i == set->size) {
+        set->size++;
+      }
+      return NULL;
+    }
+    Unsmall(set);
+  }
+  const size_t bucket = hash % set->count;
+  if (IsBounded(set) && set->size >= set->capacity &&
+      !Find(set, bucket, element, set->comparator)) {
+    Evict(set);
+  }
+  return AddToBucket(set, bucket, element);
+}
+
+void HashSetAddWithExpiry(HashSet* set, void* element, uint64_t expires) {
+  HashSetElements* es = Add(set, element, set->hasher(element));
+  if (IsExpiring(set)) {
+    ((CachedElements*)es)->expires = expires;
+    if (IsBounded(set) && expires < set->earliest_expiry) {
+      set->earliest_expiry = expires;
+    }
+  }
+}
+
+void HashSetAddWithHash(HashSet* set, void* element, size_t hash) {
+  HashSetElements* es = Add(set, element, hash);
+  if (IsExpiring(set)) {
+    // A replaced element’s expiry does not carry over to its replacement.
+    ((CachedElements*)es)->expires = Never;
+  }
+}
+
+void HashSetBuildFilter(HashSet* set) {
+  if (IsSmall(set)) {
+    // The filter shares space with the small elements.
+    Unsmall(set);
+  }
+  free(set->filter);
+  const size_t bytes = FilterBlockWords * sizeof(uint64_t);
+  const size_t bits = (set->size > set->count ? set->size : set->count) *
+                      FilterBitsPerElement;
+  set->filter_blocks = bits / (bytes * 8) + 1;
+  set->filter = aligned_alloc(bytes, set->filter_blocks * bytes);
+  memset(set->filter, 0, set->filter_blocks * bytes);
+  HashSetIterator it = IteratorNewUntraced(set);
+  void* element;
+  while ((element = HashSetIteratorNext(&it))) {
+    FilterAdd(set, set->hasher(element));
   }
 }
 
@@ -56,7 +666,23 @@ bool HashSetContains(const HashSet* set, const void* element) {
   return HashSetGet(set, element) != NULL;
 }
 
+bool HashSetContainsByKey(const HashSet* set,
+                          const void* key,
+                          KeyHasher* hasher,
+                          KeyComparator* comparator) {
+  return HashSetGetByKey(set, key, hasher, comparator) != NULL;
+}
+
+bool HashSetContainsWithHash(const HashSet* set,
+                             const void* element,
+                             size_t hash) {
+  return HashSetGetWithHash(set, element, hash) != NULL;
+}
+
 void HashSetDelete(HashSet* set) {
+  if (IsSmall(set)) {
+    return;
+  }
   for (size_t i = 0; i < set->count; i++) {
     for (HashSetElements* es = set->elements[i]; es != NULL;) {
       HashSetElements* next = es->next;
@@ -64,40 +690,269 @@ void HashSetDelete(HashSet* set) {
       es = next;
     }
   }
-  free(set->elements);
+  FreeHuge(set->elements);
+  free(set->filter);
+  free(set->trees);
+}
+
+// Returns the element matching `key`, according to `compare`, or `NULL`.
+static void* Get(const HashSet* set,
+                 const void* key,
+                 size_t hash,
+                 Comparator* compare) {
+  if (HasFilter(set) && !FilterMayContain(set, hash)) {
+    return NULL;
+  }
+  if (IsSmall(set)) {
+    const size_t i = FindSmall(set, key, compare);
+    return i < set->size ? set->small[i] : NULL;
+  }
+  HashSetElements* es = Find(set, hash % set->count, key, compare);
+  if (es == NULL || (IsExpiring(set) && IsExpired(set, es, set->clock()))) {
+    return NULL;
+  }
+  Reference(set, es);
+  return es->element;
+}
+
+// How many elements to hash before probing. Hashing a batch first, and
+// prefetching the buckets the hashes land in, lets the memory accesses for the
+// probes overlap instead of happening one after another.
+enum { BatchSize = 16 };
+
+typedef struct Batch {
+  size_t count;
+  void* elements[BatchSize];
+  size_t hashes[BatchSize];
+} Batch;
+
+// Fills `batch` with the next elements from `i`, hashed for lookup in `target`.
+// Returns false if `i` has no more elements.
+static bool NextBatch(HashSetIterator* i, const HashSet* target, Batch* batch) {
+  batch->count = 0;
+  void* element;
+  while (batch->count < BatchSize && (element = HashSetIteratorNext(i))) {
+    const size_t hash = target->hasher(element);
+    if (!IsSmall(target)) {
+      __builtin_prefetch(&target->elements[hash % target->count]);
+    }
+    batch->elements[batch->count] = element;
+    batch->hashes[batch->count] = hash;
+    batch->count++;
+  }
+  return batch->count > 0;
+}
+
+// Returns true if matching elements of `a` and `b` are always in the same
+// bucket, in which case set operations can proceed bucket by bucket.
+static bool Mergeable(const HashSet* a, const HashSet* b) {
+  return a->count == b->count && a->hasher == b->hasher && !IsSmall(a) &&
+         !IsSmall(b) && !IsExpiring(a) && !IsExpiring(b);
+}
+
+static size_t Max(size_t a, size_t b) {
+  return a > b ? a : b;
+}
+
+// Returns an empty set to hold the result of a set operation on `a` and `b`,
+// which will have at most `size` elements.
+static HashSet NewResult(const HashSet* a, const HashSet* b, size_t size) {
+  return HashSetNewWithOptions(Mergeable(a, b) ? a->count : Max(1, size),
+                               a->hasher, a->comparator,
+                               a->options & (HashSetSorted | HashSetTreeify));
+}
+
+// Adds to `result` each element of `source` that is not in `other`. `result`
+// must not already contain any of those elements.
+static void AddMissing(HashSet* result,
+                       const HashSet* source,
+                       const HashSet* other) {
+  if (Mergeable(source, other) && Mergeable(result, source)) {
+    for (size_t i = 0; i < source->count; i++) {
+      for (HashSetElements* es = source->elements[i]; es; es = es->next) {
+        if (!Find(other, i, es->element, other->comparator)) {
+          AddToBucket(result, i, es->element);
+        }
+      }
+    }
+    return;
+  }
+
+  const bool same_hasher = result->hasher == other->hasher;
+  HashSetIterator it = IteratorNewUntraced(source);
+  Batch batch;
+  while (NextBatch(&it, other, &batch)) {
+    for (size_t i = 0; i < batch.count; i++) {
+      void* element = batch.elements[i];
+      if (!Get(other, element, batch.hashes[i], other->comparator)) {
+        HashSetAddWithHash(result, element,
+                           same_hasher ? batch.hashes[i]
+                                       : result->hasher(element));
+      }
+    }
+  }
+}
+
+HashSet HashSetDifference(const HashSet* a, const HashSet* b) {
+  HashSet result = NewResult(a, b, a->size);
+  AddMissing(&result, a, b);
+  return result;
 }
 
 void* HashSetGet(const HashSet* set, const void* element) {
-  const size_t hash = set->hasher(element) % set->count;
-  HashSetElements* es = set->elements[hash];
-  while (es) {
-    if (set->comparator(es->element, element) == 0) {
-      return es->element;
+  return HashSetGetWithHash(set, element, set->hasher(element));
+}
+
+void* HashSetGetByKey(const HashSet* set,
+                      const void* key,
+                      KeyHasher* hasher,
+                      KeyComparator* comparator) {
+  const size_t hash = hasher(key);
+  void* element = Get(set, key, hash, comparator);
+  // A trace records elements, not keys, so it can record only hits.
+  if (element) {
+    Trace(set, HashSetTraceGet, element, hash);
+  }
+  return element;
+}
+
+void* HashSetGetWithHash(const HashSet* set, const void* element, size_t hash) {
+  Trace(set, HashSetTraceGet, element, hash);
+  return Get(set, element, hash, set->comparator);
+}
+
+HashSet HashSetIntersect(const HashSet* a, const HashSet* b) {
+  if (Mergeable(a, b)) {
+    HashSet result = NewResult(a, b, 0);
+    for (size_t i = 0; i < a->count; i++) {
+      for (HashSetElements* es = a->elements[i]; es; es = es->next) {
+        if (Find(b, i, es->element, b->comparator)) {
+          AddToBucket(&result, i, es->element);
+        }
+      }
     }
-    es = es->next;
+    return result;
   }
-  return NULL;
+
+  // Iterate the smaller set, and probe the larger.
+  const bool a_smaller = a->size <= b->size;
+  const HashSet* smaller = a_smaller ? a : b;
+  const HashSet* larger = a_smaller ? b : a;
+  HashSet result = NewResult(a, b, smaller->size);
+  const bool same_hasher = result.hasher == larger->hasher;
+  HashSetIterator it = IteratorNewUntraced(smaller);
+  Batch batch;
+  while (NextBatch(&it, larger, &batch)) {
+    for (size_t i = 0; i < batch.count; i++) {
+      void* found =
+          Get(larger, batch.elements[i], batch.hashes[i], larger->comparator);
+      if (found) {
+        void* element = a_smaller ? batch.elements[i] : found;
+        HashSetAddWithHash(&result, element,
+                           same_hasher ? batch.hashes[i]
+                                       : result.hasher(element));
+      }
+    }
+  }
+  return result;
 }
 
 HashSet HashSetNew(size_t count, Hasher* hasher, Comparator* comparator) {
-  return (HashSet){.count = count,
-                   .elements = calloc(count, sizeof(HashSetElements*)),
-                   .hasher = hasher,
-                   .comparator = comparator};
+  return HashSetNewWithOptions(count, hasher, comparator, 0);
+}
+
+HashSet HashSetNewBounded(size_t count,
+                          Hasher* hasher,
+                          Comparator* comparator,
+                          size_t capacity,
+                          Evictor* evictor,
+                          void* context) {
+  HashSet set = HashSetNew(count, hasher, comparator);
+  set.capacity = capacity;
+  set.evictor = evictor;
+  set.evictor_context = context;
+  return set;
+}
+
+HashSet HashSetNewExpiring(size_t count,
+                           Hasher* hasher,
+                           Comparator* comparator,
+                           Clock* clock,
+                           Evictor* evictor,
+                           void* context) {
+  HashSet set = HashSetNew(count, hasher, comparator);
+  set.clock = clock;
+  set.evictor = evictor;
+  set.evictor_context = context;
+  return set;
+}
+
+HashSet HashSetNewWithOptions(size_t count,
+                              Hasher* hasher,
+                              Comparator* comparator,
+                              size_t options) {
+  const bool small = options & HashSetSmall;
+  return (HashSet){
+      .count = count,
+      .elements = small ? NULL : CallocHuge(count, sizeof(HashSetElements*)),
+      .hasher = hasher,
+      .comparator = comparator,
+      .options = options};
+}
+
+size_t HashSetReapExpired(HashSet* set, size_t budget) {
+  if (!IsExpiring(set)) {
+    return 0;
+  }
+  const uint64_t now = set->clock();
+  uint64_t earliest = Never;
+  size_t reaped = 0;
+  for (size_t i = 0; i < budget && i < set->count; i++) {
+    reaped += ReapBucket(set, set->reap_bucket, now, &earliest);
+    set->reap_bucket = (set->reap_bucket + 1) % set->count;
+  }
+  return reaped;
 }
 
 void HashSetRemove(HashSet* set, const void* element) {
-  const size_t hash = set->hasher(element) % set->count;
+  HashSetRemoveWithHash(set, element, set->hasher(element));
+}
+
+// Removes the element matching `key`, according to `compare`, if one is
+// present.
+static void Remove(HashSet* set,
+                   const void* key,
+                   size_t hash,
+                   Comparator* compare) {
+  if (IsSmall(set)) {
+    const size_t i = FindSmall(set, key, compare);
+    if (i < set->size) {
+      set->size--;
+      set->small[i] = set->small[set->size];
+    }
+    return;
+  }
+  hash %= set->count;
+  if (IsTree(set, hash)) {
+    TreeRemoveElement(set, hash, key, compare);
+    return;
+  }
   HashSetElements* es = set->elements[hash];
   HashSetElements* previous = NULL;
+  const bool sorted = set->options & HashSetSorted;
   while (es) {
-    if (set->comparator(es->element, element) == 0) {
+    const int c = compare(es->element, key);
+    if (c > 0 && sorted) {
+      return;
+    }
+    if (c == 0) {
       if (previous) {
         previous->next = es->next;
       } else {
         set->elements[hash] = es->next;
       }
       free(es);
+      set->size--;
       return;
     }
     previous = es;
@@ -105,19 +960,104 @@ void HashSetRemove(HashSet* set, const void* element) {
   }
 }
 
-HashSetIterator HashSetIteratorNew(HashSet* set) {
+void HashSetRemoveByKey(HashSet* set,
+                        const void* key,
+                        KeyHasher* hasher,
+                        KeyComparator* comparator) {
+  const size_t hash = hasher(key);
+  if (set->tracer) {
+    // A trace records elements, not keys, so find the one being removed.
+    const void* element = NULL;
+    if (IsSmall(set)) {
+      const size_t i = FindSmall(set, key, comparator);
+      element = i < set->size ? set->small[i] : NULL;
+    } else {
+      const HashSetElements* es = Find(set, hash % set->count, key, comparator);
+      element = es ? es->element : NULL;
+    }
+    if (element) {
+      Trace(set, HashSetTraceRemove, element, hash);
+    }
+  }
+  Remove(set, key, hash, comparator);
+}
+
+void HashSetRemoveWithHash(HashSet* set, const void* element, size_t hash) {
+  Trace(set, HashSetTraceRemove, element, hash);
+  Remove(set, element, hash, set->comparator);
+}
+
+HashSet HashSetSymmetricDifference(const HashSet* a, const HashSet* b) {
+  HashSet result = NewResult(a, b, a->size + b->size);
+  AddMissing(&result, a, b);
+  AddMissing(&result, b, a);
+  return result;
+}
+
+HashSet HashSetUnion(const HashSet* a, const HashSet* b) {
+  HashSet result = NewResult(a, b, a->size + b->size);
+  if (Mergeable(&result, a)) {
+    for (size_t i = 0; i < a->count; i++) {
+      for (HashSetElements* es = a->elements[i]; es; es = es->next) {
+        AddToBucket(&result, i, es->element);
+      }
+    }
+  } else {
+    HashSetIterator it = IteratorNewUntraced(a);
+    void* element;
+    while ((element = HashSetIteratorNext(&it))) {
+      HashSetAdd(&result, element);
+    }
+  }
+  AddMissing(&result, b, a);
+  return result;
+}
+
+HashSetIterator HashSetIteratorNew(const HashSet* set) {
+  Trace(set, HashSetTraceIterate, NULL, 0);
+  return HashSetIteratorNewRange(set, 0, set->count);
+}
+
+HashSetIterator HashSetIteratorNewRange(const HashSet* set,
+                                        size_t begin,
+                                        size_t end) {
   return (HashSetIterator){
-      .bucket = 0, .element = set->elements[0], .set = set};
+      .bucket = begin,
+      .end = end,
+      .element = begin < end && !IsSmall(set) ? set->elements[begin] : NULL,
+      .small = 0,
+      .now = IsExpiring(set) ? set->clock() : 0,
+      .set = set};
+}
+
+// Returns the next element of a small set in the iterator’s range of buckets.
+static void* NextSmall(HashSetIterator* i) {
+  const HashSet* set = i->set;
+  const bool all = i->bucket == 0 && i->end == set->count;
+  while (i->small < set->size) {
+    void* element = set->small[i->small++];
+    const size_t bucket = all ? 0 : set->hasher(element) % set->count;
+    if (all || (bucket >= i->bucket && bucket < i->end)) {
+      return element;
+    }
+  }
+  return NULL;
 }
 
 void* HashSetIteratorNext(HashSetIterator* i) {
-  while (i->bucket < i->set->count) {
+  if (IsSmall(i->set)) {
+    return NextSmall(i);
+  }
+  while (i->bucket < i->end) {
     if (i->element) {
       HashSetElements* e = i->element;
       i->element = e->next;
-      return e->element;
+      if (!IsExpired(i->set, e, i->now)) {
+        return e->element;
+      }
+      continue;
     }
-    if (++(i->bucket) == i->set->count) {
+    if (++(i->bucket) == i->end) {
       break;
     }
     i->element = i->set->elements[i->bucket];
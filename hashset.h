@@ -6,6 +6,7 @@
 
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 
 // A hash map/set of opaque, dynamically typed elements.
 //
@@ -35,44 +36,300 @@ typedef size_t Hasher(const void* element);
 // it sorts after, and 0 if they compare equal.
 typedef int Comparator(const void* a, const void* b);
 
+// The `ByKey` variants of `HashSetContains`, `HashSetGet`, and `HashSetRemove`
+// look elements up by a bare key, instead of by an element with the same key
+// part. That saves building a dummy element for each lookup, which matters for
+// wide elements.
+//
+// A `KeyHasher` must return the same hash for `key` as the set’s `Hasher`
+// returns for an element with that key part.
+typedef size_t KeyHasher(const void* key);
+
+// Compares the key part of `element` to `key`, as `Comparator` would compare
+// it to an element with that key part. (If the set is neither `HashSetSorted`
+// nor `HashSetTreeify`, only whether the result is 0 matters.)
+typedef int KeyComparator(const void* element, const void* key);
+
+// Called with each element that a bounded set evicts, and the `context` given
+// to `HashSetNewBounded`. For example, it might `free` the element.
+typedef void Evictor(void* element, void* context);
+
+// Returns the current time, in whatever units the caller uses for expiry times.
+// It must never go backwards.
+typedef uint64_t Clock(void);
+
+// The operations that a `Tracer` sees.
+enum HashSetTraceOperation {
+  HashSetTraceAdd,
+  HashSetTraceGet,
+  HashSetTraceRemove,
+  HashSetTraceIterate,
+};
+
+// Called with each operation on a set whose `tracer` is not `NULL`: adds (of
+// any kind), `HashSetGetWithHash` (and so `HashSetGet` and `HashSetContains`),
+// `HashSetRemoveWithHash` (and so `HashSetRemove`), and `HashSetIteratorNew`,
+// with the element, its hash, and `tracer_context`. For `HashSetTraceIterate`,
+// `element` is `NULL` and `hash` is 0. See trace.h.
+typedef void Tracer(enum HashSetTraceOperation operation,
+                    const void* element,
+                    size_t hash,
+                    void* context);
+
 typedef struct HashSetElements {
   void* element;
   struct HashSetElements* next;
 } HashSetElements;
 
+// The most elements a `HashSetSmall` set holds before allocating its buckets.
+enum { HashSetSmallSize = 8 };
+
 typedef struct HashSet {
+  // The number of buckets.
   size_t count;
+  // The number of elements.
+  size_t size;
+  // `NULL` while a `HashSetSmall` set is still small.
   HashSetElements** elements;
   Hasher* hasher;
   Comparator* comparator;
+  // A combination of `HashSetOptions`.
+  size_t options;
+  union {
+    // The state of a set with buckets, which a small set doesn’t need.
+    struct {
+      // An optional Bloom filter, which lets lookups of absent elements return
+      // without touching `elements`. See `HashSetBuildFilter`.
+      uint64_t* filter;
+      // The number of 64-byte blocks in `filter`.
+      size_t filter_blocks;
+      // With `HashSetTreeify`, a bit for each bucket that has become a tree.
+      uint64_t* trees;
+      // For bounded sets, the maximum number of elements; otherwise 0.
+      size_t capacity;
+      Evictor* evictor;
+      void* evictor_context;
+      // The bucket where the next search for an element to evict starts.
+      size_t hand;
+      // The bucket where the next `HashSetReapExpired` starts.
+      size_t reap_bucket;
+      // In a bounded, expiring set, a time before which no element expires.
+      uint64_t earliest_expiry;
+    };
+    // While `elements` is `NULL`, the elements, in no particular order.
+    void* small[HashSetSmallSize];
+  };
+  // For expiring sets, the source of the current time; otherwise `NULL`.
+  Clock* clock;
+  // If not `NULL`, called with each operation on the set.
+  Tracer* tracer;
+  void* tracer_context;
 } HashSet;
 
+// Options for `HashSetNewWithOptions`. Combine them with `|`.
+enum HashSetOptions {
+  // Keep each bucket’s list in the order given by the `Comparator`. Lookups and
+  // removals of absent elements can then stop at the first greater element,
+  // instead of walking to the end of the list. This helps most when the set
+  // has more elements than buckets.
+  HashSetSorted = 1 << 0,
+
+  // Turn any bucket whose list grows longer than 8 elements into a balanced
+  // tree, ordered by the `Comparator`, and back into a list when it shrinks.
+  // This bounds the cost of lookups at O(log n), even with a bad `Hasher` or
+  // adversarial elements.
+  //
+  // The elements of a tree bucket are still linked by `HashSetElements.next`
+  // (starting from `elements[bucket]`), but not in any particular order.
+  HashSetTreeify = 1 << 1,
+
+  // Keep up to `HashSetSmallSize` elements in the `HashSet` itself, and find
+  // them by linear search. The buckets are allocated only when the set
+  // outgrows that, so that creating and using a small set makes no
+  // allocations at all. (The small elements share space with the filter, tree
+  // bits, and bounding state, which only sets with buckets use.)
+  //
+  // Until then, `elements` is `NULL`; use `HashSetIterator` to visit the
+  // elements.
+  HashSetSmall = 1 << 2,
+};
+
 void HashSetAdd(HashSet* set, void* element);
 
+// Adds `element` to an expiring set, to expire at time `expires` (according to
+// `set->clock`). `HashSetAdd` adds elements that never expire, even when they
+// replace ones that would have. For sets that don’t expire elements, this is
+// the same as `HashSetAdd`.
+void HashSetAddWithExpiry(HashSet* set, void* element, uint64_t expires);
+
+// The `WithHash` variants of `HashSetAdd`, `HashSetContains`, `HashSetGet`, and
+// `HashSetRemove` take a `hash` that the caller has already computed, and do
+// not call `set->hasher`. This is useful when the same key goes into several
+// sets that share a `Hasher`, and hashing it is expensive.
+//
+// `hash` must be the value that `set->hasher` would return for `element`;
+// otherwise, the set will misbehave.
+void HashSetAddWithHash(HashSet* set, void* element, size_t hash);
+
+// Builds a Bloom filter for `set`, or rebuilds its existing one. From then on,
+// `HashSetAdd` keeps the filter up to date, and lookups check it first. Most
+// lookups of absent elements then cost 1 cache line access, instead of a bucket
+// and a list walk.
+//
+// The filter is sized for `count` or `size` elements, whichever is greater.
+// `HashSetRemove` cannot remove elements from the filter, so after many
+// removals (or additions beyond the size of the filter), call this again to
+// restore its effectiveness.
+//
+// A `HashSetSmall` set that is still small allocates its buckets first.
+void HashSetBuildFilter(HashSet* set);
+
 bool HashSetContains(const HashSet* set, const void* element);
 
+bool HashSetContainsByKey(const HashSet* set,
+                          const void* key,
+                          KeyHasher* hasher,
+                          KeyComparator* comparator);
+
+bool HashSetContainsWithHash(const HashSet* set,
+                             const void* element,
+                             size_t hash);
+
 // `free`s the `HashSet`’s internal storage, but not the elements. The caller
 // owns the elements.
 void HashSetDelete(HashSet* set);
 
+// Returns a new `HashSet` containing the elements of `a` that are not in `b`.
+//
+// The set-algebra functions (`HashSetDifference`, `HashSetIntersect`,
+// `HashSetSymmetricDifference`, and `HashSetUnion`) require that `a` and `b`
+// have `Comparator`s that agree. The new set uses `a`’s `Hasher`,
+// `Comparator`, and `HashSetSorted` and `HashSetTreeify` options, and is sized
+// for the largest possible result. When an element is in both sets, the new
+// set gets `a`’s.
+//
+// If `a` and `b` have the same `count` and `Hasher`, matching elements must be
+// in the same bucket, so these functions merge the sets bucket by bucket
+// without hashing anything. Otherwise, they probe the other set in batches.
+//
+// As with all `HashSet`s, the caller owns the elements, and must call
+// `HashSetDelete` on the new set.
+HashSet HashSetDifference(const HashSet* a, const HashSet* b);
+
 // Returns the element in `set` matching the key part of `element`, or `NULL` if
 // no matching element is present.
 void* HashSetGet(const HashSet* set, const void* element);
 
+void* HashSetGetByKey(const HashSet* set,
+                      const void* key,
+                      KeyHasher* hasher,
+                      KeyComparator* comparator);
+
+void* HashSetGetWithHash(const HashSet* set, const void* element, size_t hash);
+
+// Returns a new `HashSet` containing the elements that are in both `a` and `b`.
+// See `HashSetDifference`.
+HashSet HashSetIntersect(const HashSet* a, const HashSet* b);
+
 HashSet HashSetNew(size_t count, Hasher* hasher, Comparator* comparator);
 
+// Returns a new `HashSet` that holds at most `capacity` (which must be at least
+// 1) elements, for use as a cache. When adding a new element to a full set, it
+// first evicts another, chosen by the CLOCK algorithm: each element has a bit
+// that `HashSetGet` (and `HashSetAdd`, when replacing) set, and a “hand” sweeps
+// the buckets, clearing set bits and evicting the first element whose bit is
+// clear. So elements that are used again soon tend to stay, and new elements
+// that are never used go first.
+//
+// If `evictor` is not `NULL`, the set calls it with each evicted element and
+// `context`. (It does not call it for elements removed by `HashSetRemove`, or
+// still present at `HashSetDelete`.)
+//
+// Looking elements up only sets their bit; it doesn’t move them around, so
+// concurrent lookups are safe (as long as nothing modifies the set).
+//
+// Bounded sets do not support any `HashSetOptions`.
+HashSet HashSetNewBounded(size_t count,
+                          Hasher* hasher,
+                          Comparator* comparator,
+                          size_t capacity,
+                          Evictor* evictor,
+                          void* context);
+
+// Returns a new `HashSet` whose elements can expire. See
+// `HashSetAddWithExpiry`.
+//
+// Expired elements are absent as far as `HashSetGet`, `HashSetContains`,
+// `HashSetIterator`, and the set operations are concerned, but they stay in
+// memory (and count in `size`) until `HashSetReapExpired` removes them, or
+// `HashSetAdd` replaces them. `HashSetReapExpired` passes them to `evictor`, if
+// it is not `NULL`, with `context`.
+//
+// Expiring sets do not support any `HashSetOptions`. To make a bounded set that
+// also expires elements, set `clock` on a new bounded set, before adding any
+// elements. When such a set is full and some elements have expired, adding
+// a new element reaps them all instead of evicting a live one.
+HashSet HashSetNewExpiring(size_t count,
+                           Hasher* hasher,
+                           Comparator* comparator,
+                           Clock* clock,
+                           Evictor* evictor,
+                           void* context);
+
+// Returns a new `HashSet` with the given `HashSetOptions`.
+HashSet HashSetNewWithOptions(size_t count,
+                              Hasher* hasher,
+                              Comparator* comparator,
+                              size_t options);
+
+// Removes up to `budget` buckets’ worth of expired elements from `set`,
+// continuing from where the last call left off, and returns how many it
+// removed. Calling this regularly with a small `budget` keeps an expiring set
+// from filling up with expired elements, without ever stalling to scan all of
+// it.
+size_t HashSetReapExpired(HashSet* set, size_t budget);
+
 // Removes from `set` the element matching the key part of `element`, if one is
 // present.
 void HashSetRemove(HashSet* set, const void* element);
 
+void HashSetRemoveByKey(HashSet* set,
+                        const void* key,
+                        KeyHasher* hasher,
+                        KeyComparator* comparator);
+
+void HashSetRemoveWithHash(HashSet* set, const void* element, size_t hash);
+
+// Returns a new `HashSet` containing the elements that are in exactly one of
+// `a` and `b`. See `HashSetDifference`.
+HashSet HashSetSymmetricDifference(const HashSet* a, const HashSet* b);
+
+// Returns a new `HashSet` containing the elements that are in either `a` or
+// `b`. See `HashSetDifference`.
+HashSet HashSetUnion(const HashSet* a, const HashSet* b);
+
 typedef struct HashSetIterator {
   size_t bucket;
+  // The bucket at which to stop.
+  size_t end;
   HashSetElements* element;
-  HashSet* set;
+  // The index of the next element in `set->small`, for small sets.
+  size_t small;
+  // For expiring sets, the time at which the iterator was created. It skips
+  // elements that had expired by then.
+  uint64_t now;
+  const HashSet* set;
 } HashSetIterator;
 
 // Returns a `HashSetIterator` that starts at the beginning of `set`.
-HashSetIterator HashSetIteratorNew(HashSet* set);
+HashSetIterator HashSetIteratorNew(const HashSet* set);
+
+// Returns a `HashSetIterator` over only the elements in buckets `begin` through
+// `end - 1` of `set`. Iterators over disjoint ranges can run concurrently, as
+// long as nothing modifies `set`.
+HashSetIterator HashSetIteratorNewRange(const HashSet* set,
+                                        size_t begin,
+                                        size_t end);
 
 // Returns the next element, or `NULL` if iteration has ended.
 void* HashSetIteratorNext(HashSetIterator* i);
@@ -0,0 +1,169 @@
+// Copyright 2023 Chris Palmer, https://noncombatant.org/
+// SPDX-License-Identifier: Apache-2.0
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "inline.h"
+#include "util.h"
+
+enum { TagShift = 48 };
+
+// Returns the tag for an element with `hash`: 0 if `set` is not tagged. Many
+// `Hasher`s leave their high bits 0, so take them after `MixHash`.
+static uint64_t Tag(const InlineSet* set, size_t hash) {
+  return set->options & InlineSetTagged ? (uint64_t)MixHash(hash) >> TagShift
+                                        : 0;
+}
+
+static uint64_t TagOf(const void* stored) {
+  return (uint64_t)(uintptr_t)stored >> TagShift;
+}
+
+static void* Tagged(void* element, uint64_t tag) {
+  return (void*)(uintptr_t)((uint64_t)(uintptr_t)element | tag << TagShift);
+}
+
+static void* Untagged(const void* stored) {
+  return (void*)(uintptr_t)((uint64_t)(uintptr_t)stored &
+                            (UINT64_MAX >> (64 - TagShift)));
+}
+
+// Returns whether the node `e` holds the element matching `element`, whose tag
+// is `tag`.
+static bool Matches(const InlineSet* set,
+                    const InlineElements* e,
+                    const void* element,
+                    uint64_t tag) {
+  return TagOf(e->element) == tag &&
+         set->comparator(Untagged(e->element), element) == 0;
+}
+
+// Returns the node in bucket of `hash` holding the element matching `element`,
+// or `NULL`.
+static InlineElements* Find(const InlineSet* set,
+                            size_t hash,
+                            const void* element) {
+  InlineElements* e = &set->buckets[hash % set->count];
+  if (e->element == NULL) {
+    return NULL;
+  }
+  const uint64_t tag = Tag(set, hash);
+  for (; e; e = e->next) {
+    if (Matches(set, e, element, tag)) {
+      return e;
+    }
+  }
+  return NULL;
+}
+
+void InlineSetAdd(InlineSet* set, void* element) {
+  const size_t hash = set->hasher(element);
+  void* stored = Tagged(element, Tag(set, hash));
+  InlineElements* found = Find(set, hash, element);
+  if (found) {
+    found->element = stored;
+    return;
+  }
+
+  InlineElements* head = &set->buckets[hash % set->count];
+  if (head->element == NULL) {
+    head->element = stored;
+  } else {
+    InlineElements* e = malloc(sizeof(InlineElements));
+    e->element = stored;
+    e->next = head->next;
+    head->next = e;
+  }
+  set->size++;
+}
+
+bool InlineSetContains(const InlineSet* set, const void* element) {
+  return InlineSetGet(set, element) != NULL;
+}
+
+void InlineSetDelete(InlineSet* set) {
+  for (size_t i = 0; i < set->count; i++) {
+    InlineElements* e = set->buckets[i].next;
+    while (e) {
+      InlineElements* next = e->next;
+      free(e);
+      e = next;
+    }
+  }
+  FreeHuge(set->buckets);
+}
+
+void* InlineSetGet(const InlineSet* set, const void* element) {
+  const InlineElements* e = Find(set, set->hasher(element), element);
+  return e ? Untagged(e->element) : NULL;
+}
+
+InlineSet InlineSetNew(size_t count, Hasher* hasher, Comparator* comparator) {
+  return InlineSetNewWithOptions(count, hasher, comparator, 0);
+}
+
+InlineSet InlineSetNewWithOptions(size_t count,
+                                  Hasher* hasher,
+                                  Comparator* comparator,
+                                  size_t options) {
+  if (sizeof(void*) < sizeof(uint64_t)) {
+    options &= ~(size_t)InlineSetTagged;
+  }
+  return (InlineSet){.count = count,
+                     .buckets = CallocHuge(count, sizeof(InlineElements)),
+                     .hasher = hasher,
+                     .comparator = comparator,
+                     .options = options};
+}
+
+void InlineSetRemove(InlineSet* set, const void* element) {
+  const size_t hash = set->hasher(element);
+  InlineElements* head = &set->buckets[hash % set->count];
+  if (head->element == NULL) {
+    return;
+  }
+
+  const uint64_t tag = Tag(set, hash);
+  InlineElements* removed;
+  if (Matches(set, head, element, tag)) {
+    // Move the second element, if any, into the bucket array.
+    removed = head->next;
+    *head = removed ? *removed : (InlineElements){.element = NULL};
+  } else {
+    InlineElements* previous = head;
+    for (removed = head->next; removed; removed = removed->next) {
+      if (Matches(set, removed, element, tag)) {
+        break;
+      }
+      previous = removed;
+    }
+    if (removed == NULL) {
+      return;
+    }
+    previous->next = removed->next;
+  }
+  free(removed);
+  set->size--;
+}
+
+InlineSetIterator InlineSetIteratorNew(const InlineSet* set) {
+  return (InlineSetIterator){
+      .bucket = 0, .element = &set->buckets[0], .set = set};
+}
+
+void* InlineSetIteratorNext(InlineSetIterator* i) {
+  const InlineSet* set = i->set;
+  while (true) {
+    if (i->element && i->element->element) {
+      void* element = Untagged(i->element->element);
+      i->element = i->element->next;
+      return element;
+    }
+    if (i->bucket + 1 >= set->count) {
+      return NULL;
+    }
+    i->bucket++;
+    i->element = &set->buckets[i->bucket];
+  }
+}
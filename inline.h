@@ -0,0 +1,93 @@
+// Copyright 2023 Chris Palmer, https://noncombatant.org/
+// SPDX-License-Identifier: Apache-2.0
+
+#ifndef INLINE_H
+#define INLINE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "hashset.h"
+
+// A set with the same interface as `HashSet`, but whose bucket array holds the
+// first element of each bucket directly, instead of a pointer to a list node.
+// Only the second and later elements of a bucket go in separately allocated
+// nodes.
+//
+// At sane load factors, most non-empty buckets have just 1 element, so most
+// lookups go straight from the bucket array to the element, saving a cache
+// miss. Sets with few collisions also make far fewer allocations.
+//
+// With `InlineSetTagged`, lookups can also skip most non-matching elements
+// without touching their memory. See `InlineSetOptions`.
+
+typedef struct InlineElements {
+  // In the bucket array, `NULL` means the bucket is empty. With
+  // `InlineSetTagged`, the top 16 bits of the pointer hold a tag.
+  void* element;
+  struct InlineElements* next;
+} InlineElements;
+
+typedef struct InlineSet {
+  // The number of buckets.
+  size_t count;
+  // The number of elements.
+  size_t size;
+  // The first element of each bucket, and the head of the list of the rest.
+  InlineElements* buckets;
+  Hasher* hasher;
+  Comparator* comparator;
+  // A combination of `InlineSetOptions`.
+  size_t options;
+} InlineSet;
+
+// Options for `InlineSetNewWithOptions`. Combine them with `|`.
+enum InlineSetOptions {
+  // Store the top 16 bits of each element’s hash, after `MixHash`, in the top
+  // 16 bits of its pointer, which are otherwise 0 on x86-64 and AArch64
+  // (without top-byte ignore or pointer authentication) Linux. Lookups then
+  // call the `Comparator` only for elements whose tags match, so they almost
+  // never touch the memory of elements that collide with the one sought.
+  //
+  // Use this only on platforms with 64-bit pointers whose top 16 bits are
+  // always 0. On other platforms, `InlineSetNewWithOptions` ignores it.
+  InlineSetTagged = 1 << 0,
+};
+
+void InlineSetAdd(InlineSet* set, void* element);
+
+bool InlineSetContains(const InlineSet* set, const void* element);
+
+// `free`s the `InlineSet`’s internal storage, but not the elements. The caller
+// owns the elements.
+void InlineSetDelete(InlineSet* set);
+
+// Returns the element in `set` matching the key part of `element`, or `NULL` if
+// no matching element is present.
+void* InlineSetGet(const InlineSet* set, const void* element);
+
+InlineSet InlineSetNew(size_t count, Hasher* hasher, Comparator* comparator);
+
+// Returns a new `InlineSet` with the given `InlineSetOptions`.
+InlineSet InlineSetNewWithOptions(size_t count,
+                                  Hasher* hasher,
+                                  Comparator* comparator,
+                                  size_t options);
+
+// Removes from `set` the element matching the key part of `element`, if one is
+// present.
+void InlineSetRemove(InlineSet* set, const void* element);
+
+typedef struct InlineSetIterator {
+  size_t bucket;
+  const InlineElements* element;
+  const InlineSet* set;
+} InlineSetIterator;
+
+// Returns an `InlineSetIterator` that starts at the beginning of `set`.
+InlineSetIterator InlineSetIteratorNew(const InlineSet* set);
+
+// Returns the next element, or `NULL` if iteration has ended.
+void* InlineSetIteratorNext(InlineSetIterator* i);
+
+#endif
@@ -0,0 +1,119 @@
+// Copyright 2023 Chris Palmer, https://noncombatant.org/
+// SPDX-License-Identifier: Apache-2.0
+
+#include <stdalign.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "interner.h"
+#include "util.h"
+
+// The size of a typical arena block. Larger strings get blocks of their own.
+enum { BlockSize = 1 << 20 };
+
+// The header of each string in the arena, and the elements of the `HashSet`.
+// `bytes` points just past the header.
+typedef struct InternedString {
+  size_t hash;
+  size_t length;
+  const char* bytes;
+} InternedString;
+
+static size_t Hash(const char* string, size_t length) {
+  return MixHash(StringHashN(string, length));
+}
+
+static size_t InternedHash(const void* interned) {
+  const InternedString* s = interned;
+  return s->hash;
+}
+
+static int InternedCompare(const void* a, const void* b) {
+  const InternedString* s1 = a;
+  const InternedString* s2 = b;
+  if (s1->length != s2->length) {
+    return s1->length < s2->length ? -1 : 1;
+  }
+  // `bytes` may be `NULL` when `length` is 0, and `memcmp` must not see that.
+  return s1->length ? memcmp(s1->bytes, s2->bytes, s1->length) : 0;
+}
+
+// Returns `size` bytes from the arena, aligned for an `InternedString`.
+static void* Allocate(StringInterner* interner, size_t size) {
+  const size_t alignment = alignof(InternedString);
+  size = (size + alignment - 1) / alignment * alignment;
+  ArenaBlock* block = interner->block;
+  if (size > BlockSize) {
+    // Give it a block of its own, behind the current one, which keeps filling.
+    ArenaBlock* own = malloc(sizeof(ArenaBlock) + size);
+    own->size = size;
+    if (block) {
+      own->previous = block->previous;
+      block->previous = own;
+    } else {
+      own->previous = NULL;
+      interner->block = own;
+      interner->used = size;
+    }
+    return own + 1;
+  }
+  if (block == NULL || interner->used + size > block->size) {
+    block = malloc(sizeof(ArenaBlock) + BlockSize);
+    block->previous = interner->block;
+    block->size = BlockSize;
+    interner->block = block;
+    interner->used = 0;
+  }
+  void* p = (char*)(block + 1) + interner->used;
+  interner->used += size;
+  return p;
+}
+
+void StringInternerDelete(StringInterner* interner) {
+  HashSetDelete(&interner->set);
+  ArenaBlock* block = interner->block;
+  while (block) {
+    ArenaBlock* previous = block->previous;
+    free(block);
+    block = previous;
+  }
+}
+
+const char* StringInternerGet(const StringInterner* interner,
+                              const char* string,
+                              size_t length) {
+  const InternedString probe = {
+      .hash = Hash(string, length), .length = length, .bytes = string};
+  const InternedString* s =
+      HashSetGetWithHash(&interner->set, &probe, probe.hash);
+  return s ? s->bytes : NULL;
+}
+
+const char* StringInternerIntern(StringInterner* interner,
+                                 const char* string,
+                                 size_t length) {
+  const InternedString probe = {
+      .hash = Hash(string, length), .length = length, .bytes = string};
+  const InternedString* found =
+      HashSetGetWithHash(&interner->set, &probe, probe.hash);
+  if (found) {
+    return found->bytes;
+  }
+
+  InternedString* s = Allocate(interner, sizeof(InternedString) + length + 1);
+  char* bytes = (char*)(s + 1);
+  if (length) {
+    memcpy(bytes, string, length);
+  }
+  bytes[length] = '\0';
+  *s = (InternedString){.hash = probe.hash, .length = length, .bytes = bytes};
+  HashSetAddWithHash(&interner->set, s, s->hash);
+  return bytes;
+}
+
+StringInterner StringInternerNew(size_t count) {
+  return (StringInterner){
+      .set = HashSetNew(count, InternedHash, InternedCompare),
+      .block = NULL,
+      .used = 0};
+}
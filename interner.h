@@ -0,0 +1,57 @@
+// Copyright 2023 Chris Palmer, https://noncombatant.org/
+// SPDX-License-Identifier: Apache-2.0
+
+#ifndef INTERNER_H
+#define INTERNER_H
+
+#include <stddef.h>
+
+#include "hashset.h"
+
+// A `StringInterner` keeps 1 canonical copy of each distinct string given to
+// it. Interning equal strings returns the same pointer, so callers can then
+// compare strings by comparing pointers.
+//
+// The copies live in an arena: large blocks that are filled in order and never
+// individually freed. Each copy is stored with its length and hash, right
+// before its bytes, and the `HashSet` of copies points into the arena. So
+// interning a new string costs 1 bump allocation (plus a list node), instead
+// of separate `malloc`s for the string and node; and `StringInternerDelete`
+// frees everything at once.
+
+// A block of the arena.
+typedef struct ArenaBlock {
+  struct ArenaBlock* previous;
+  // The number of bytes after this header.
+  size_t size;
+} ArenaBlock;
+
+typedef struct StringInterner {
+  HashSet set;
+  // The block being filled. Earlier blocks are linked through `previous`.
+  ArenaBlock* block;
+  // The number of bytes of `block` in use.
+  size_t used;
+} StringInterner;
+
+// `free`s the `StringInterner`, including all the canonical strings.
+void StringInternerDelete(StringInterner* interner);
+
+// Returns the canonical copy of the `length` bytes at `string`, or `NULL` if
+// they have not been interned. `string` may be `NULL` if `length` is 0.
+const char* StringInternerGet(const StringInterner* interner,
+                              const char* string,
+                              size_t length);
+
+// Returns the canonical copy of the `length` bytes at `string`, copying them
+// into `interner` if this is the first time. The copy is followed by a `NUL`,
+// so it is also a C string (if `string` has no `NUL`s). It remains valid until
+// `StringInternerDelete`. `string` may be `NULL` if `length` is 0.
+const char* StringInternerIntern(StringInterner* interner,
+                                 const char* string,
+                                 size_t length);
+
+// Returns a new `StringInterner` whose `HashSet` has `count` buckets.
+StringInterner StringInternerNew(size_t count);
+
+#endif
@@ -0,0 +1,97 @@
+// Copyright 2023 Chris Palmer, https://noncombatant.org/
+// SPDX-License-Identifier: Apache-2.0
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "lines.h"
+#include "util.h"
+
+// Returns the number of lines in the `length` bytes at `text`.
+static size_t CountLines(const char* text, size_t length) {
+  size_t count = 0;
+  const char* end = text + length;
+  // `memchr` is typically vectorized, so this runs at memory bandwidth.
+  for (const char* p = text; p < end; count++) {
+    const char* newline = memchr(p, '\n', (size_t)(end - p));
+    p = newline ? newline + 1 : end;
+  }
+  return count;
+}
+
+bool HashSetLoadLines(const char* path, LineSet* lines) {
+  const int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+  struct stat status;
+  if (fstat(fd, &status) != 0) {
+    (void)close(fd);
+    return false;
+  }
+  const size_t length = (size_t)status.st_size;
+  if (length == 0) {
+    // `mmap` can’t map 0 bytes.
+    (void)close(fd);
+    *lines = (LineSet){.set = HashSetNew(1, StringViewHash, StringViewCompare)};
+    return true;
+  }
+  void* mapping = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+  const int error = errno;
+  (void)close(fd);
+  if (mapping == MAP_FAILED) {
+    errno = error;
+    return false;
+  }
+
+  const char* text = mapping;
+  const size_t count = CountLines(text, length);
+  *lines = (LineSet){
+      .set = HashSetNew(count, StringViewHash, StringViewCompare),
+      .lines = calloc(count, sizeof(StringView)),
+      .count = count,
+      .mapping = mapping,
+      .length = length};
+
+  const char* end = text + length;
+  const char* p = text;
+  for (size_t i = 0; i < count; i++) {
+    const char* newline = memchr(p, '\n', (size_t)(end - p));
+    const char* line_end = newline ? newline : end;
+    lines->lines[i] =
+        (StringView){.bytes = p, .length = (size_t)(line_end - p)};
+    HashSetAdd(&lines->set, &lines->lines[i]);
+    p = newline ? newline + 1 : end;
+  }
+  return true;
+}
+
+void LineSetClose(LineSet* lines) {
+  HashSetDelete(&lines->set);
+  free(lines->lines);
+  if (lines->mapping) {
+    (void)munmap(lines->mapping, lines->length);
+  }
+}
+
+int StringViewCompare(const void* a, const void* b) {
+  const StringView* v1 = a;
+  const StringView* v2 = b;
+  const size_t length = v1->length < v2->length ? v1->length : v2->length;
+  const int c = memcmp(v1->bytes, v2->bytes, length);
+  if (c != 0 || v1->length == v2->length) {
+    return c;
+  }
+  return v1->length < v2->length ? -1 : 1;
+}
+
+size_t StringViewHash(const void* view) {
+  const StringView* v = view;
+  return StringHashN(v->bytes, v->length);
+}
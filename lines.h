@@ -0,0 +1,54 @@
+// Copyright 2023 Chris Palmer, https://noncombatant.org/
+// SPDX-License-Identifier: Apache-2.0
+
+#ifndef LINES_H
+#define LINES_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "hashset.h"
+
+// Loads the lines of a text file (such as a word list) into a `HashSet`
+// without copying them. The file is memory-mapped, and the set’s elements are
+// `StringView`s that point into the mapping.
+
+// A counted string. It need not be `NUL`-terminated.
+typedef struct StringView {
+  const char* bytes;
+  size_t length;
+} StringView;
+
+// A `Hasher` for `StringView`s. It agrees with `StringHash`: a `StringView` of
+// a C string has the same hash as the C string.
+size_t StringViewHash(const void* view);
+
+// A `Comparator` for `StringView`s.
+int StringViewCompare(const void* a, const void* b);
+
+typedef struct LineSet {
+  // The distinct lines, as `StringView`s, without their newlines. Look lines up
+  // with `StringView`s, e.g. `HashSetContains(&lines.set, &(StringView){"cat",
+  // 3})`.
+  HashSet set;
+  // All the lines, in order, including duplicates. The elements of `set` point
+  // into this array.
+  StringView* lines;
+  // The number of lines.
+  size_t count;
+  void* mapping;
+  size_t length;
+} LineSet;
+
+// Maps the file at `path`, and fills in `lines` with its lines. Lines end at
+// each `'\n'`; a last line without one counts too. (Any `'\r'` before a `'\n'`
+// is part of the line.) The set has as many buckets as the file has lines.
+//
+// Returns false (and sets `errno`) on error.
+bool HashSetLoadLines(const char* path, LineSet* lines);
+
+// Unmaps the file, and `free`s `lines`’ storage. Views into the file are no
+// longer valid.
+void LineSetClose(LineSet* lines);
+
+#endif
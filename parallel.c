@@ -0,0 +1,215 @@
+// Copyright 2023 Chris Palmer, https://noncombatant.org/
+// SPDX-License-Identifier: Apache-2.0
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+
+#include "parallel.h"
+
+// A step of a parallel operation. Each thread runs the same `Phase` with its
+// own `Worker`.
+typedef void* Phase(void* worker);
+
+// Runs `phase` on each of the `threads` `workers` (each `size` bytes long) in
+// its own thread, and waits for them all to finish. If a thread cannot be
+// started, its worker runs on the calling thread instead. (If `size` is 0, all
+// the threads share 1 worker.)
+static void Run(void* workers, size_t size, size_t threads, Phase* phase) {
+  pthread_t* ids = calloc(threads, sizeof(pthread_t));
+  bool* started = calloc(threads, sizeof(bool));
+  for (size_t i = 0; i < threads; i++) {
+    void* worker = (char*)workers + i * size;
+    started[i] = pthread_create(&ids[i], NULL, phase, worker) == 0;
+    if (!started[i]) {
+      phase(worker);
+    }
+  }
+  for (size_t i = 0; i < threads; i++) {
+    if (started[i]) {
+      pthread_join(ids[i], NULL);
+    }
+  }
+  free(started);
+  free(ids);
+}
+
+// Returns the start of the `i`th of `threads` slices of `n` items. The slices
+// differ in size by at most 1.
+static size_t SliceStart(size_t n, size_t threads, size_t i) {
+  const size_t remainder = n % threads;
+  return n / threads * i + (i < remainder ? i : remainder);
+}
+
+typedef struct Entry {
+  void* element;
+  size_t bucket;
+} Entry;
+
+// The state shared by the threads of a `HashSetBuildParallel` call.
+typedef struct Build {
+  void* const* elements;
+  size_t n;
+  size_t threads;
+  // The number of buckets in each thread’s partition of `set->elements`.
+  size_t span;
+  // The bucket of each element.
+  size_t* buckets;
+  // A `threads` × `threads` matrix: for each slice of `elements` (row) and
+  // each partition (column), first the number of elements, and then (after
+  // `PrefixSums`) the next position in `entries`.
+  size_t* offsets;
+  // `elements`, grouped by partition and otherwise in their original order.
+  Entry* entries;
+  HashSet* set;
+} Build;
+
+typedef struct Worker {
+  Build* build;
+  size_t index;
+  // The number of elements this worker added to `build->set`.
+  size_t added;
+} Worker;
+
+static void* HashSlice(void* worker) {
+  Worker* w = worker;
+  Build* b = w->build;
+  size_t* counts = &b->offsets[w->index * b->threads];
+  const size_t end = SliceStart(b->n, b->threads, w->index + 1);
+  for (size_t i = SliceStart(b->n, b->threads, w->index); i < end; i++) {
+    const size_t bucket = b->set->hasher(b->elements[i]) % b->set->count;
+    b->buckets[i] = bucket;
+    counts[bucket / b->span]++;
+  }
+  return NULL;
+}
+
+static void PrefixSums(Build* b) {
+  size_t sum = 0;
+  for (size_t partition = 0; partition < b->threads; partition++) {
+    for (size_t slice = 0; slice < b->threads; slice++) {
+      size_t* offset = &b->offsets[slice * b->threads + partition];
+      const size_t count = *offset;
+      *offset = sum;
+      sum += count;
+    }
+  }
+}
+
+static void* ScatterSlice(void* worker) {
+  Worker* w = worker;
+  Build* b = w->build;
+  size_t* offsets = &b->offsets[w->index * b->threads];
+  const size_t end = SliceStart(b->n, b->threads, w->index + 1);
+  for (size_t i = SliceStart(b->n, b->threads, w->index); i < end; i++) {
+    const size_t bucket = b->buckets[i];
+    b->entries[offsets[bucket / b->span]++] =
+        (Entry){.element = b->elements[i], .bucket = bucket};
+  }
+  return NULL;
+}
+
+static void* BuildPartition(void* worker) {
+  Worker* w = worker;
+  Build* b = w->build;
+  // After `ScatterSlice`, the last slice’s offset for each partition is where
+  // the partition ends.
+  const size_t* ends = &b->offsets[(b->threads - 1) * b->threads];
+  const size_t start = w->index == 0 ? 0 : ends[w->index - 1];
+
+  // This thread only touches buckets in its own partition, so it can use the
+  // shared `elements` array. But it must count its additions separately.
+  HashSet partition = *b->set;
+  partition.size = 0;
+  for (size_t i = start; i < ends[w->index]; i++) {
+    HashSetAddWithHash(&partition, b->entries[i].element, b->entries[i].bucket);
+  }
+  w->added = partition.size;
+  return NULL;
+}
+
+HashSet HashSetBuildParallel(void* const elements[],
+                             size_t n,
+                             size_t threads,
+                             size_t count,
+                             Hasher* hasher,
+                             Comparator* comparator) {
+  HashSet set = HashSetNew(count, hasher, comparator);
+  if (threads == 0) {
+    threads = 1;
+  }
+  Build build = {.elements = elements,
+                 .n = n,
+                 .threads = threads,
+                 .span = (count + threads - 1) / threads,
+                 .buckets = calloc(n, sizeof(size_t)),
+                 .offsets = calloc(threads * threads, sizeof(size_t)),
+                 .entries = calloc(n, sizeof(Entry)),
+                 .set = &set};
+  Worker* workers = calloc(threads, sizeof(Worker));
+  for (size_t i = 0; i < threads; i++) {
+    workers[i] = (Worker){.build = &build, .index = i};
+  }
+
+  Run(workers, sizeof(Worker), threads, HashSlice);
+  PrefixSums(&build);
+  Run(workers, sizeof(Worker), threads, ScatterSlice);
+  Run(workers, sizeof(Worker), threads, BuildPartition);
+  for (size_t i = 0; i < threads; i++) {
+    set.size += workers[i].added;
+  }
+
+  free(workers);
+  free(build.entries);
+  free(build.offsets);
+  free(build.buckets);
+  return set;
+}
+
+// The state shared by the threads of a `HashSetForEachParallel` call.
+typedef struct ForEach {
+  const HashSet* set;
+  HashSetVisitor* visit;
+  void* context;
+  // The number of buckets to claim at a time.
+  size_t chunk;
+  // The first bucket not yet claimed.
+  atomic_size_t next;
+} ForEach;
+
+static void* VisitChunks(void* for_each) {
+  ForEach* f = for_each;
+  const size_t count = f->set->count;
+  while (true) {
+    const size_t begin =
+        atomic_fetch_add_explicit(&f->next, f->chunk, memory_order_relaxed);
+    if (begin >= count) {
+      break;
+    }
+    const size_t end = count - begin < f->chunk ? count : begin + f->chunk;
+    HashSetIterator it = HashSetIteratorNewRange(f->set, begin, end);
+    void* element;
+    while ((element = HashSetIteratorNext(&it))) {
+      f->visit(element, f->context);
+    }
+  }
+  return NULL;
+}
+
+void HashSetForEachParallel(const HashSet* set,
+                            HashSetVisitor* visit,
+                            void* context,
+                            size_t threads) {
+  if (threads == 0) {
+    threads = 1;
+  }
+  // Enough chunks per thread that the threads finish at about the same time,
+  // but few enough that claiming them is cheap.
+  const size_t chunk = set->count / (threads * 16);
+  ForEach f = {.set = set,
+               .visit = visit,
+               .context = context,
+               .chunk = chunk > 0 ? chunk : 1};
+  atomic_init(&f.next, 0);
+  Run(&f, 0, threads, VisitChunks);
+}
@@ -0,0 +1,45 @@
+// Copyright 2023 Chris Palmer, https://noncombatant.org/
+// SPDX-License-Identifier: Apache-2.0
+
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <stddef.h>
+
+#include "hashset.h"
+
+// Multi-threaded operations on `HashSet`s. These use POSIX threads; the rest of
+// `HashSet` does not, so callers that don’t need them need not link this file.
+
+// Returns a new `HashSet` with `count` buckets containing the `n` `elements`,
+// built using `threads` threads.
+//
+// Each thread hashes a slice of `elements`, and then the elements are
+// partitioned by the range of buckets they fall into, so that each thread can
+// build its own disjoint range of `set->elements` without locking. The result
+// is the same as calling `HashSetAdd` on each element in order; in particular,
+// if several elements have the same key, the last one wins.
+//
+// This temporarily allocates about 24 bytes per element.
+HashSet HashSetBuildParallel(void* const elements[],
+                             size_t n,
+                             size_t threads,
+                             size_t count,
+                             Hasher* hasher,
+                             Comparator* comparator);
+
+// Called by `HashSetForEachParallel` for each `element`, with the caller’s
+// `context`. It is called concurrently from several threads, so it must be
+// thread-safe with respect to `context`.
+typedef void HashSetVisitor(void* element, void* context);
+
+// Calls `visit` for each element of `set`, using `threads` threads. The threads
+// take turns claiming chunks of the bucket array, so that they stay busy even
+// if some chunks take longer than others. `set` must not change during the
+// call.
+void HashSetForEachParallel(const HashSet* set,
+                            HashSetVisitor* visit,
+                            void* context,
+                            size_t threads);
+
+#endif
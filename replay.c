@@ -0,0 +1,301 @@
+// Copyright 2023 Chris Palmer, https://noncombatant.org/
+// SPDX-License-Identifier: Apache-2.0
+
+// Replays a trace (see trace.h) against set implementations and
+// configurations, and reports how each performed. `./replay TRACE` replays it
+// against all the `Backends`; `./replay TRACE NAME...` against only the named
+// ones.
+//
+// Options:
+//
+//   -n COUNT  Create each set with `COUNT` buckets (or slots). The default is
+//             the most elements the traced set ever held.
+//
+// The elements are the trace’s keys, and their hashes are the recorded ones,
+// so the sets see the same hash distribution as the traced set did. The
+// replay runs as fast as it can, rather than at the recorded times.
+//
+// Each backend replays the trace in its own process, twice: once to measure
+// throughput and memory (the growth in peak resident set size, which includes
+// everything the set allocated), and once to time each operation.
+
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "backend.h"
+#include "chunked.h"
+#include "compact.h"
+#include "cuckoo.h"
+#include "hashset.h"
+#include "inline.h"
+#include "robinhood.h"
+#include "timing.h"
+#include "trace.h"
+#include "util.h"
+
+// Returns the peak resident set size of this process, in KiB.
+static size_t PeakKiB(void) {
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+  return (size_t)usage.ru_maxrss / 1024;
+#else
+  return (size_t)usage.ru_maxrss;
+#endif
+}
+
+// The elements of the replayed sets: `TraceEvent`s, whose `bytes` are the key.
+// Sets find them by their recorded `hash`.
+
+static size_t EventHash(const void* event) {
+  const TraceEvent* e = event;
+  return (size_t)e->hash;
+}
+
+static int EventCompare(const void* a, const void* b) {
+  const TraceEvent* e1 = a;
+  const TraceEvent* e2 = b;
+  if (e1->hash != e2->hash) {
+    return e1->hash < e2->hash ? -1 : 1;
+  }
+  if (e1->length != e2->length) {
+    return e1->length < e2->length ? -1 : 1;
+  }
+  return memcmp(e1->bytes, e2->bytes, e1->length);
+}
+
+// A set implementation, or configuration, to replay a trace against. `new_set`
+// returns a pointer to its kind of set, and `operations` acts on it.
+typedef void* NewSet(size_t count);
+
+typedef struct Backend {
+  const char* name;
+  NewSet* new_set;
+  const SetOperations* operations;
+} Backend;
+
+// Defines `New##Set`, which allocates a `Set` of `EventHash`ed `TraceEvent`s,
+// and `Set##Operations`.
+#define DEFINE_BACKEND(Set)                          \
+  static void* New##Set(size_t count) {              \
+    Set* set = malloc(sizeof(Set));                  \
+    *set = Set##New(count, EventHash, EventCompare); \
+    return set;                                      \
+  }                                                  \
+  DEFINE_SET_OPERATIONS(Set)
+
+DEFINE_BACKEND(ChunkedSet);
+DEFINE_BACKEND(CompactSet);
+DEFINE_BACKEND(CuckooSet);
+DEFINE_BACKEND(HashSet);
+DEFINE_BACKEND(InlineSet);
+DEFINE_BACKEND(RobinHoodSet);
+
+static void* NewHashSetWithOptions(size_t count, size_t options) {
+  HashSet* set = malloc(sizeof(HashSet));
+  *set = HashSetNewWithOptions(count, EventHash, EventCompare, options);
+  return set;
+}
+
+static void* NewSortedHashSet(size_t count) {
+  return NewHashSetWithOptions(count, HashSetSorted);
+}
+
+static void* NewSmallHashSet(size_t count) {
+  return NewHashSetWithOptions(count, HashSetSmall);
+}
+
+static void* NewTreeifyHashSet(size_t count) {
+  return NewHashSetWithOptions(count, HashSetTreeify);
+}
+
+static void* NewTaggedInlineSet(size_t count) {
+  InlineSet* set = malloc(sizeof(InlineSet));
+  *set = InlineSetNewWithOptions(count, EventHash, EventCompare,
+                                 InlineSetTagged);
+  return set;
+}
+
+static const Backend Backends[] = {
+    {"hashset", NewHashSet, &HashSetOperations},
+    {"sorted", NewSortedHashSet, &HashSetOperations},
+    {"treeify", NewTreeifyHashSet, &HashSetOperations},
+    {"small", NewSmallHashSet, &HashSetOperations},
+    {"chunked", NewChunkedSet, &ChunkedSetOperations},
+    {"compact", NewCompactSet, &CompactSetOperations},
+    {"cuckoo", NewCuckooSet, &CuckooSetOperations},
+    {"inline", NewInlineSet, &InlineSetOperations},
+    {"tagged", NewTaggedInlineSet, &InlineSetOperations},
+    {"robinhood", NewRobinHoodSet, &RobinHoodSetOperations},
+};
+
+// A trace, and what replaying it should do.
+typedef struct Replay {
+  Trace trace;
+  // For each event, whether it is a `HashSetTraceGet` that should find an
+  // element.
+  bool* hits;
+  // For each `HashSetTraceOperation`, the number of events.
+  size_t counts[HashSetTraceIterate + 1];
+  // The most elements the set held.
+  size_t peak;
+  // The total number of elements that iterations visit.
+  size_t visited;
+} Replay;
+
+// Performs `events[i]` on `set`, and returns the number of elements it found,
+// or visited.
+static size_t Apply(const SetOperations* o,
+                    void* set,
+                    TraceEvent* events,
+                    size_t i) {
+  const size_t operation = events[i].operation;
+  if (operation == HashSetTraceAdd) {
+    o->add(set, &events[i]);
+    return 0;
+  } else if (operation == HashSetTraceGet) {
+    return o->get(set, &events[i]) != NULL;
+  } else if (operation == HashSetTraceRemove) {
+    o->remove(set, &events[i]);
+    return 0;
+  }
+  return o->iterate(set);
+}
+
+// Replays `r` against a `HashSet`, to find out what the others should do.
+static void Simulate(Replay* r) {
+  const Trace* t = &r->trace;
+  r->hits = calloc(t->count + 1, sizeof(bool));
+  HashSet set = HashSetNew(t->count / 2 + 1, EventHash, EventCompare);
+  for (size_t i = 0; i < t->count; i++) {
+    const size_t operation = t->events[i].operation;
+    r->counts[operation]++;
+    if (operation == HashSetTraceGet) {
+      r->hits[i] = HashSetContains(&set, &t->events[i]);
+    } else if (operation == HashSetTraceAdd) {
+      HashSetAdd(&set, &t->events[i]);
+    } else if (operation == HashSetTraceRemove) {
+      HashSetRemove(&set, &t->events[i]);
+    } else {
+      r->visited += set.size;
+    }
+    r->peak = set.size > r->peak ? set.size : r->peak;
+  }
+  HashSetDelete(&set);
+}
+
+static void Run(const Backend* b, const Replay* r, size_t count) {
+  const Trace* t = &r->trace;
+  const size_t baseline = PeakKiB();
+  void* set = b->new_set(count);
+  size_t mismatches = 0;
+  size_t visited = 0;
+  const double start = Now();
+  for (size_t i = 0; i < t->count; i++) {
+    const size_t found = Apply(b->operations, set, t->events, i);
+    if (t->events[i].operation == HashSetTraceGet) {
+      mismatches += found != r->hits[i];
+    } else {
+      visited += found;
+    }
+  }
+  const double seconds = Now() - start;
+  const size_t memory = PeakKiB() - baseline;
+  b->operations->delete_set(set);
+  free(set);
+  printf("%-24s %7.2f M ops/s  peak RSS +%zu KiB", b->name,
+         (double)t->count / seconds / 1e6, memory);
+  if (mismatches || visited != r->visited) {
+    printf("  %zu WRONG lookups, %zu of %zu elements visited", mismatches,
+           visited, r->visited);
+  }
+  printf("\n");
+
+  uint64_t* latencies[HashSetTraceIterate + 1];
+  size_t n[HashSetTraceIterate + 1] = {0};
+  for (size_t o = 0; o <= HashSetTraceIterate; o++) {
+    latencies[o] = calloc(r->counts[o] + 1, sizeof(uint64_t));
+  }
+  const uint64_t overhead = TimerOverhead();
+  set = b->new_set(count);
+  for (size_t i = 0; i < t->count; i++) {
+    const uint64_t begin = Nanos();
+    (void)Apply(b->operations, set, t->events, i);
+    const uint64_t elapsed = Nanos() - begin;
+    const size_t o = t->events[i].operation;
+    latencies[o][n[o]++] = elapsed > overhead ? elapsed - overhead : 0;
+  }
+  b->operations->delete_set(set);
+  free(set);
+
+  static const char* const names[] = {"add", "get", "remove", "iterate"};
+  for (size_t o = 0; o <= HashSetTraceIterate; o++) {
+    if (n[o]) {
+      char label[64];
+      snprintf(label, sizeof(label), "%s %s", b->name, names[o]);
+      PrintLatencies(label, latencies[o], n[o]);
+    }
+    free(latencies[o]);
+  }
+}
+
+int main(int count, char* arguments[]) {
+  size_t buckets = 0;
+  int first = 1;
+  if (count > 2 && StringEquals(arguments[1], "-n")) {
+    buckets = strtoull(arguments[2], NULL, 0);
+    first = 3;
+  }
+  if (first >= count) {
+    fprintf(stderr, "Usage: replay [-n COUNT] TRACE [BACKEND...]\n");
+    return EXIT_FAILURE;
+  }
+  Replay r = {.trace = TraceOpen(arguments[first])};
+  if (r.trace.mapping == NULL) {
+    perror(arguments[first]);
+    return EXIT_FAILURE;
+  }
+
+  Simulate(&r);
+  const Trace* t = &r.trace;
+  const double seconds =
+      t->count ? (double)t->events[t->count - 1].time / 1e9 : 0;
+  printf("%zu operations (%zu adds, %zu gets, %zu removes, %zu iterations) "
+         "over %.3f s; at most %zu elements\n",
+         t->count, r.counts[HashSetTraceAdd], r.counts[HashSetTraceGet],
+         r.counts[HashSetTraceRemove], r.counts[HashSetTraceIterate], seconds,
+         r.peak);
+  buckets = buckets ? buckets : r.peak + 1;
+
+  for (size_t i = 0; i < COUNT(Backends); i++) {
+    bool selected = count - first < 2;
+    for (int j = first + 1; j < count; j++) {
+      selected = selected || StringEquals(arguments[j], Backends[i].name);
+    }
+    if (!selected) {
+      continue;
+    }
+    // Run each backend in its own process, so that they don’t share a heap,
+    // and the peak resident set size is its own.
+    fflush(stdout);
+    const pid_t child = fork();
+    if (child == 0) {
+      Run(&Backends[i], &r, buckets);
+      fflush(stdout);
+      _exit(EXIT_SUCCESS);
+    } else if (child > 0) {
+      (void)waitpid(child, NULL, 0);
+    } else {
+      Run(&Backends[i], &r, buckets);
+    }
+  }
+
+  free(r.hits);
+  TraceClose(&r.trace);
+}
@@ -0,0 +1,138 @@
+// Copyright 2023 Chris Palmer, https://noncombatant.org/
+// SPDX-License-Identifier: Apache-2.0
+
+
+#include "robinhood.h"
+#include "util.h"
+
+static const size_t NotFound = SIZE_MAX;
+
+static size_t Next(const RobinHoodSet* set, size_t slot) {
+  return (slot + 1) & (set->count - 1);
+}
+
+// Returns the slot of the element matching `element`, or `NotFound`.
+static size_t Find(const RobinHoodSet* set, const void* element) {
+  const size_t mixed = MixHash(set->hasher(element));
+  const uint32_t tag = (uint32_t)(mixed >> 32);
+  size_t slot = mixed & (set->count - 1);
+  for (uint32_t distance = 0;; distance++) {
+    const RobinHoodSlot* s = &set->slots[slot];
+    if (s->element == NULL || s->distance < distance) {
+      return NotFound;
+    }
+    if (s->distance == distance && s->tag == tag &&
+        set->comparator(s->element, element) == 0) {
+      return slot;
+    }
+    slot = Next(set, slot);
+  }
+}
+
+// Puts `element`, which must not already be in `set`, in its place. `set` must
+// have at least 1 empty slot.
+static void Place(RobinHoodSet* set, void* element) {
+  const size_t mixed = MixHash(set->hasher(element));
+  RobinHoodSlot entry = {
+      .element = element, .distance = 0, .tag = (uint32_t)(mixed >> 32)};
+  size_t slot = mixed & (set->count - 1);
+  while (set->slots[slot].element) {
+    RobinHoodSlot* s = &set->slots[slot];
+    if (s->distance < entry.distance) {
+      const RobinHoodSlot displaced = *s;
+      *s = entry;
+      entry = displaced;
+    }
+    slot = Next(set, slot);
+    entry.distance++;
+  }
+  set->slots[slot] = entry;
+}
+
+static void Grow(RobinHoodSet* set) {
+  RobinHoodSet bigger =
+      RobinHoodSetNew(set->count * 2, set->hasher, set->comparator);
+  bigger.size = set->size;
+  for (size_t i = 0; i < set->count; i++) {
+    if (set->slots[i].element) {
+      Place(&bigger, set->slots[i].element);
+    }
+  }
+  FreeHuge(set->slots);
+  *set = bigger;
+}
+
+void RobinHoodSetAdd(RobinHoodSet* set, void* element) {
+  const size_t slot = Find(set, element);
+  if (slot != NotFound) {
+    set->slots[slot].element = element;
+    return;
+  }
+  // Keep at least 1 slot empty, even in tables too small for `count / 8` to
+  // be more than 0, so that probes for absent elements always stop.
+  const size_t reserve = set->count / 8 > 0 ? set->count / 8 : 1;
+  if (set->size + 1 > set->count - reserve) {
+    Grow(set);
+  }
+  Place(set, element);
+  set->size++;
+}
+
+bool RobinHoodSetContains(const RobinHoodSet* set, const void* element) {
+  return RobinHoodSetGet(set, element) != NULL;
+}
+
+void RobinHoodSetDelete(RobinHoodSet* set) {
+  FreeHuge(set->slots);
+}
+
+void* RobinHoodSetGet(const RobinHoodSet* set, const void* element) {
+  const size_t slot = Find(set, element);
+  return slot == NotFound ? NULL : set->slots[slot].element;
+}
+
+RobinHoodSet RobinHoodSetNew(size_t count,
+                             Hasher* hasher,
+                             Comparator* comparator) {
+  // At least 2 slots, so that `RobinHoodSetAdd` can keep 1 empty.
+  size_t slots = 2;
+  while (slots < count) {
+    slots *= 2;
+  }
+  return (RobinHoodSet){.count = slots,
+                        .slots = CallocHuge(slots, sizeof(RobinHoodSlot)),
+                        .hasher = hasher,
+                        .comparator = comparator};
+}
+
+void RobinHoodSetRemove(RobinHoodSet* set, const void* element) {
+  size_t slot = Find(set, element);
+  if (slot == NotFound) {
+    return;
+  }
+  // Shift the rest of the probe sequence back, until we reach an empty slot
+  // or an element that is already in its home slot.
+  for (size_t next = Next(set, slot);
+       set->slots[next].element && set->slots[next].distance > 0;
+       next = Next(set, next)) {
+    set->slots[slot] = set->slots[next];
+    set->slots[slot].distance--;
+    slot = next;
+  }
+  set->slots[slot] = (RobinHoodSlot){.element = NULL};
+  set->size--;
+}
+
+RobinHoodSetIterator RobinHoodSetIteratorNew(const RobinHoodSet* set) {
+  return (RobinHoodSetIterator){.slot = 0, .set = set};
+}
+
+void* RobinHoodSetIteratorNext(RobinHoodSetIterator* i) {
+  while (i->slot < i->set->count) {
+    void* element = i->set->slots[i->slot++].element;
+    if (element) {
+      return element;
+    }
+  }
+  return NULL;
+}
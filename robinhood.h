@@ -0,0 +1,80 @@
+// Copyright 2023 Chris Palmer, https://noncombatant.org/
+// SPDX-License-Identifier: Apache-2.0
+
+#ifndef ROBINHOOD_H
+#define ROBINHOOD_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "hashset.h"
+
+// A set with the same interface as `HashSet`, but using Robin Hood hashing: an
+// open-addressing scheme with linear probing, in which an element being added
+// takes the slot of any element that is closer to its home slot than the new
+// element is to its own. This keeps probe sequences short and even. Unlike
+// `HashSet`, adding an element does not allocate (except when the set grows).
+//
+// Each slot stores its element’s distance from its home slot. Lookups of absent
+// elements stop as soon as they reach an element closer to its home than the
+// lookup is to its own, because the element they seek would have displaced it.
+//
+// Removing an element shifts the following elements of its probe sequence back
+// by 1 slot, instead of leaving a “tombstone”. So, unlike with tombstones,
+// lookups don’t slow down as elements are removed and added over time.
+
+typedef struct RobinHoodSlot {
+  // Empty slots are `NULL`.
+  void* element;
+  // The distance from the element’s home slot.
+  uint32_t distance;
+  // The high 32 bits of the element’s (mixed) hash. Lookups compare these
+  // before calling the `Comparator`.
+  uint32_t tag;
+} RobinHoodSlot;
+
+typedef struct RobinHoodSet {
+  // The number of slots. Always a power of 2.
+  size_t count;
+  // The number of elements.
+  size_t size;
+  RobinHoodSlot* slots;
+  Hasher* hasher;
+  Comparator* comparator;
+} RobinHoodSet;
+
+void RobinHoodSetAdd(RobinHoodSet* set, void* element);
+
+bool RobinHoodSetContains(const RobinHoodSet* set, const void* element);
+
+// `free`s the `RobinHoodSet`’s internal storage, but not the elements. The
+// caller owns the elements.
+void RobinHoodSetDelete(RobinHoodSet* set);
+
+// Returns the element in `set` matching the key part of `element`, or `NULL` if
+// no matching element is present.
+void* RobinHoodSetGet(const RobinHoodSet* set, const void* element);
+
+// Returns a new `RobinHoodSet` with at least `count` slots. The set doubles in
+// size when it becomes 7/8 full.
+RobinHoodSet RobinHoodSetNew(size_t count,
+                             Hasher* hasher,
+                             Comparator* comparator);
+
+// Removes from `set` the element matching the key part of `element`, if one is
+// present.
+void RobinHoodSetRemove(RobinHoodSet* set, const void* element);
+
+typedef struct RobinHoodSetIterator {
+  size_t slot;
+  const RobinHoodSet* set;
+} RobinHoodSetIterator;
+
+// Returns a `RobinHoodSetIterator` that starts at the beginning of `set`.
+RobinHoodSetIterator RobinHoodSetIteratorNew(const RobinHoodSet* set);
+
+// Returns the next element, or `NULL` if iteration has ended.
+void* RobinHoodSetIteratorNext(RobinHoodSetIterator* i);
+
+#endif
@@ -0,0 +1,204 @@
+// Copyright 2023 Chris Palmer, https://noncombatant.org/
+// SPDX-License-Identifier: Apache-2.0
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "snapshot.h"
+
+// The file format is:
+//
+//   `Header`
+//   `uint64_t` bucket starts (`count + 1` of them)
+//   `uint64_t` element offsets (`size` of them)
+//   padding to `Alignment`
+//   elements, each padded to `Alignment`
+
+// “HASHSET1”, in little-endian byte order.
+static const uint64_t Magic = 0x3154455348534148;
+
+enum { Alignment = _Alignof(max_align_t) };
+
+typedef struct Header {
+  uint64_t magic;
+  uint64_t count;
+  uint64_t size;
+  // The offset of the first element from the start of the file.
+  uint64_t blob;
+} Header;
+
+static size_t Align(size_t n) {
+  return (n + Alignment - 1) / Alignment * Alignment;
+}
+
+// Writes zeroes to pad `count` bytes to `Alignment`.
+static bool WritePadding(FILE* file, size_t count) {
+  static const char zeroes[Alignment];
+  const size_t padding = Align(count) - count;
+  return fwrite(zeroes, 1, padding, file) == padding;
+}
+
+static bool WriteUint64(FILE* file, uint64_t n) {
+  return fwrite(&n, sizeof(n), 1, file) == 1;
+}
+
+// Sets `elements[i]` to each element of `set`, and `buckets[i]` to its bucket,
+// in bucket order. Both must have room for `set->size` elements. Returns the
+// number of elements.
+static size_t GroupByBucket(const HashSet* set,
+                            void** elements,
+                            size_t* buckets) {
+  // Use 1 iterator, so that an expiring set reads its clock once, and every
+  // pass over `elements` sees the same ones.
+  HashSetIterator it = HashSetIteratorNewRange(set, 0, set->count);
+  size_t n = 0;
+  void* element;
+  while ((element = HashSetIteratorNext(&it))) {
+    // The iterator visits the buckets in order, except in a `HashSetSmall`
+    // set, which has at most `HashSetSmallSize` elements to sort.
+    const size_t bucket =
+        set->elements ? it.bucket : set->hasher(element) % set->count;
+    size_t i = n++;
+    for (; i > 0 && buckets[i - 1] > bucket; i--) {
+      elements[i] = elements[i - 1];
+      buckets[i] = buckets[i - 1];
+    }
+    elements[i] = element;
+    buckets[i] = bucket;
+  }
+  return n;
+}
+
+bool HashSetSave(const HashSet* set, const char* path, ElementSize* size) {
+  FILE* file = fopen(path, "wb");
+  if (file == NULL) {
+    return false;
+  }
+
+  // `set->size` includes any expired elements not yet reaped, which the
+  // snapshot leaves out.
+  void** elements = calloc(set->size + 1, sizeof(void*));
+  size_t* buckets = calloc(set->size + 1, sizeof(size_t));
+  const size_t n = GroupByBucket(set, elements, buckets);
+
+  const size_t index_length =
+      sizeof(Header) + sizeof(uint64_t) * (set->count + 1 + n);
+  const Header header = {.magic = Magic,
+                         .count = set->count,
+                         .size = n,
+                         .blob = Align(index_length)};
+  bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+
+  size_t start = 0;
+  for (size_t i = 0; ok && i < set->count; i++) {
+    ok = WriteUint64(file, start);
+    while (start < n && buckets[start] == i) {
+      start++;
+    }
+  }
+  ok = ok && WriteUint64(file, start);
+
+  uint64_t offset = 0;
+  for (size_t i = 0; ok && i < n; i++) {
+    ok = WriteUint64(file, offset);
+    offset += Align(size(elements[i]));
+  }
+  ok = ok && WritePadding(file, index_length);
+
+  for (size_t i = 0; ok && i < n; i++) {
+    const size_t count = size(elements[i]);
+    ok = fwrite(elements[i], 1, count, file) == count &&
+         WritePadding(file, count);
+  }
+  free(elements);
+  free(buckets);
+
+  const int error = errno;
+  if (fclose(file) != 0) {
+    return false;
+  }
+  errno = error;
+  return ok;
+}
+
+MappedHashSet HashSetOpenMapped(const char* path,
+                                Hasher* hasher,
+                                Comparator* comparator) {
+  MappedHashSet set = {.hasher = hasher, .comparator = comparator};
+  const int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    return set;
+  }
+  struct stat status;
+  if (fstat(fd, &status) != 0) {
+    (void)close(fd);
+    return set;
+  }
+  const size_t length = (size_t)status.st_size;
+  if (length < sizeof(Header)) {
+    (void)close(fd);
+    errno = EINVAL;
+    return set;
+  }
+  void* mapping = mmap(NULL, length, PROT_READ, MAP_SHARED, fd, 0);
+  const int error = errno;
+  (void)close(fd);
+  if (mapping == MAP_FAILED) {
+    errno = error;
+    return set;
+  }
+
+  // Check that the header is consistent with the file. (We don’t check every
+  // offset; that would take as long as rebuilding the set.)
+  Header header;
+  memcpy(&header, mapping, sizeof(header));
+  const char* start = mapping;
+  const void* index = start + sizeof(Header);
+  const uint64_t* buckets = index;
+  const uint64_t words = (length - sizeof(Header)) / sizeof(uint64_t);
+  if (header.magic != Magic || header.count == 0 || header.count >= words ||
+      header.size > words - header.count - 1 || header.blob > length ||
+      header.blob < sizeof(Header) + (header.count + 1 + header.size) *
+                                         sizeof(uint64_t) ||
+      buckets[header.count] != header.size) {
+    (void)munmap(mapping, length);
+    errno = EINVAL;
+    return set;
+  }
+
+  set.count = header.count;
+  set.size = header.size;
+  set.buckets = buckets;
+  set.entries = buckets + header.count + 1;
+  set.blob = start + header.blob;
+  set.mapping = mapping;
+  set.length = length;
+  return set;
+}
+
+void MappedHashSetClose(MappedHashSet* set) {
+  (void)munmap(set->mapping, set->length);
+  set->mapping = NULL;
+}
+
+bool MappedHashSetContains(const MappedHashSet* set, const void* element) {
+  return MappedHashSetGet(set, element) != NULL;
+}
+
+const void* MappedHashSetGet(const MappedHashSet* set, const void* element) {
+  const size_t bucket = set->hasher(element) % set->count;
+  for (uint64_t i = set->buckets[bucket]; i < set->buckets[bucket + 1]; i++) {
+    const void* candidate = set->blob + set->entries[i];
+    if (set->comparator(candidate, element) == 0) {
+      return candidate;
+    }
+  }
+  return NULL;
+}
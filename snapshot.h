@@ -0,0 +1,69 @@
+// Copyright 2023 Chris Palmer, https://noncombatant.org/
+// SPDX-License-Identifier: Apache-2.0
+
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "hashset.h"
+
+// Snapshots save a `HashSet` to a file in a form that can be memory-mapped and
+// used immediately, without rebuilding the set. Several processes that map the
+// same snapshot share its pages through the page cache.
+//
+// A snapshot contains copies of the elements, not pointers to them, so it works
+// only for elements that are position-independent: a flat sequence of bytes
+// with no pointers, like a C string or a structure of integers. Snapshots are
+// in the host’s byte order, and are not portable between architectures.
+
+// Returns the number of bytes in `element`. For example, for C strings, this
+// would be `strlen(element) + 1`.
+typedef size_t ElementSize(const void* element);
+
+// Writes a snapshot of `set` to the file at `path`, using `size` to find out
+// how many bytes of each element to copy. Like `HashSetIterator`, it leaves out
+// expired elements. Returns false (and sets `errno`) on error.
+bool HashSetSave(const HashSet* set, const char* path, ElementSize* size);
+
+// A read-only `HashSet`, backed by a memory-mapped snapshot file.
+typedef struct MappedHashSet {
+  // The number of buckets.
+  size_t count;
+  // The number of elements.
+  size_t size;
+  // For each bucket, the index in `entries` of its first element. There are
+  // `count + 1` of these, so that bucket `i` ends where bucket `i + 1` starts.
+  const uint64_t* buckets;
+  // For each element, its offset in `blob`.
+  const uint64_t* entries;
+  // The elements, each aligned to `alignof(max_align_t)`.
+  const char* blob;
+  void* mapping;
+  size_t length;
+  Hasher* hasher;
+  Comparator* comparator;
+} MappedHashSet;
+
+// Maps the snapshot at `path`. `hasher` and `comparator` must behave like the
+// ones of the set that was saved, and must work on the saved copies of the
+// elements.
+//
+// On error, returns a `MappedHashSet` whose `mapping` is `NULL`, and sets
+// `errno`.
+MappedHashSet HashSetOpenMapped(const char* path,
+                                Hasher* hasher,
+                                Comparator* comparator);
+
+// Unmaps `set`. Elements returned by `MappedHashSetGet` are no longer valid.
+void MappedHashSetClose(MappedHashSet* set);
+
+bool MappedHashSetContains(const MappedHashSet* set, const void* element);
+
+// Returns the saved copy of the element in `set` matching the key part of
+// `element`, or `NULL` if no matching element is present.
+const void* MappedHashSetGet(const MappedHashSet* set, const void* element);
+
+#endif
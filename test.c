@@ -4,12 +4,28 @@
 #include <sys/stat.h>
 
 #include <assert.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
+#include "backend.h"
+#include "chunked.h"
+#include "compact.h"
+#include "counter.h"
+#include "cuckoo.h"
+#include "frozen.h"
 #include "hashset.h"
+#include "inline.h"
+#include "interner.h"
+#include "lines.h"
+#include "parallel.h"
+#include "robinhood.h"
+#include "snapshot.h"
+#include "trace.h"
 #include "util.h"
 
 // Example: A dictionary of words and their definitions. The `word` is the key.
@@ -271,6 +287,1415 @@ static void TestIterator() {
   HashSetDelete(&set);
 }
 
+// Example: Set algebra on sparse arrays. Each `Item` appears in `a` if its
+// index is even, and in `b` if its index is a multiple of 3.
+
+static size_t CountElements(const HashSet* set) {
+  size_t count = 0;
+  HashSetIterator it = HashSetIteratorNew(set);
+  while (HashSetIteratorNext(&it)) {
+    count++;
+  }
+  assert(count == set->size);
+  return count;
+}
+
+static void CheckSetAlgebra(size_t a_count, size_t b_count) {
+  static Item items[600];
+  HashSet a = HashSetNew(a_count, ItemHash, ItemCompare);
+  HashSet b = HashSetNew(b_count, ItemHash, ItemCompare);
+  for (size_t i = 0; i < COUNT(items); i++) {
+    items[i] = (Item){.index = i};
+    if (i % 2 == 0) {
+      HashSetAdd(&a, &items[i]);
+    }
+    if (i % 3 == 0) {
+      HashSetAdd(&b, &items[i]);
+    }
+  }
+  assert(a.size == 300);
+  assert(b.size == 200);
+
+  HashSet u = HashSetUnion(&a, &b);
+  HashSet n = HashSetIntersect(&a, &b);
+  HashSet d = HashSetDifference(&a, &b);
+  HashSet x = HashSetSymmetricDifference(&a, &b);
+  assert(CountElements(&u) == 400);
+  assert(CountElements(&n) == 100);
+  assert(CountElements(&d) == 200);
+  assert(CountElements(&x) == 300);
+  for (size_t i = 0; i < COUNT(items); i++) {
+    const bool in_a = i % 2 == 0;
+    const bool in_b = i % 3 == 0;
+    assert(HashSetContains(&u, &items[i]) == (in_a || in_b));
+    assert(HashSetContains(&n, &items[i]) == (in_a && in_b));
+    assert(HashSetContains(&d, &items[i]) == (in_a && !in_b));
+    assert(HashSetContains(&x, &items[i]) == (in_a != in_b));
+  }
+
+  // When both sets have an element, the result gets `a`’s.
+  Item other = {.index = 0, .word = "other"};
+  HashSetAdd(&b, &other);
+  HashSet n2 = HashSetIntersect(&b, &a);
+  assert(HashSetGet(&n2, &items[0]) == &other);
+
+  HashSetDelete(&a);
+  HashSetDelete(&b);
+  HashSetDelete(&u);
+  HashSetDelete(&n);
+  HashSetDelete(&n2);
+  HashSetDelete(&d);
+  HashSetDelete(&x);
+}
+
+static void TestSetAlgebra() {
+  // Same bucket count and `Hasher`: the sets merge bucket by bucket.
+  CheckSetAlgebra(100, 100);
+  // Different bucket counts: the sets must be probed.
+  CheckSetAlgebra(100, 37);
+}
+
+// Example: Building a large set on several threads.
+
+static void CheckBuildParallel(size_t count, size_t threads) {
+  enum { N = 10000 };
+  static Item items[N];
+  static void* elements[N + 100];
+  for (size_t i = 0; i < N; i++) {
+    items[i] = (Item){.index = i, .word = "first"};
+    elements[i] = &items[i];
+  }
+  // Repeat some keys: as with `HashSetAdd`, the last one wins.
+  static Item repeats[100];
+  for (size_t i = 0; i < COUNT(repeats); i++) {
+    repeats[i] = (Item){.index = i * 7, .word = "last"};
+    elements[N + i] = &repeats[i];
+  }
+
+  HashSet set = HashSetBuildParallel(elements, COUNT(elements), threads, count,
+                                     ItemHash, ItemCompare);
+  assert(set.size == N);
+  assert(CountElements(&set) == N);
+  for (size_t i = 0; i < N; i++) {
+    const Item* item = HashSetGet(&set, &(Item){.index = i});
+    assert(item && item->index == i);
+    assert(StringEquals(item->word, i % 7 == 0 && i < 700 ? "last" : "first"));
+  }
+  assert(!HashSetContains(&set, &(Item){.index = N}));
+  HashSetDelete(&set);
+}
+
+static void TestBuildParallel() {
+  CheckBuildParallel(5000, 4);
+  CheckBuildParallel(5000, 1);
+  // More threads than buckets.
+  CheckBuildParallel(3, 8);
+}
+
+static void MarkVisited(void* item, void* visits) {
+  Item* i = item;
+  i->word = "visited";
+  atomic_fetch_add_explicit((atomic_size_t*)visits, 1, memory_order_relaxed);
+}
+
+static void TestForEachParallel() {
+  static Item items[5000];
+  HashSet set = HashSetNew(1000, ItemHash, ItemCompare);
+  for (size_t i = 0; i < COUNT(items); i++) {
+    items[i] = (Item){.index = i * 3};
+    HashSetAdd(&set, &items[i]);
+  }
+
+  // Disjoint ranges together cover the whole set.
+  size_t count = 0;
+  const size_t ends[] = {0, 1, 333, 999, 1000};
+  for (size_t i = 1; i < COUNT(ends); i++) {
+    HashSetIterator it = HashSetIteratorNewRange(&set, ends[i - 1], ends[i]);
+    Item* item;
+    while ((item = HashSetIteratorNext(&it))) {
+      assert(ItemHash(item) % set.count >= ends[i - 1]);
+      assert(ItemHash(item) % set.count < ends[i]);
+      count++;
+    }
+  }
+  assert(count == COUNT(items));
+  HashSetIterator empty = HashSetIteratorNewRange(&set, 7, 7);
+  assert(HashSetIteratorNext(&empty) == NULL);
+
+  atomic_size_t visits;
+  atomic_init(&visits, 0);
+  HashSetForEachParallel(&set, MarkVisited, &visits, 7);
+  assert(atomic_load_explicit(&visits, memory_order_relaxed) == COUNT(items));
+  for (size_t i = 0; i < COUNT(items); i++) {
+    assert(StringEquals(items[i].word, "visited"));
+  }
+  HashSetDelete(&set);
+}
+
+// Example: Saving a set of words to a snapshot file, and then using the
+// snapshot without rebuilding the set.
+
+static size_t StringSize(const void* string) {
+  return strlen(string) + 1;
+}
+
+static void CheckSnapshot(size_t options) {
+  static char* words[] = {"cat", "dog", "goat", "a somewhat longer element",
+                          "", "fish"};
+  HashSet set =
+      HashSetNewWithOptions(4, StringHash, (Comparator*)strcmp, options);
+  for (size_t i = 0; i < COUNT(words); i++) {
+    HashSetAdd(&set, words[i]);
+  }
+  char path[] = "/tmp/hashset-snapshot-XXXXXX";
+  const int fd = mkstemp(path);
+  assert(fd >= 0);
+  assert(HashSetSave(&set, path, StringSize));
+  HashSetDelete(&set);
+
+  MappedHashSet mapped =
+      HashSetOpenMapped(path, StringHash, (Comparator*)strcmp);
+  assert(mapped.mapping);
+  assert(mapped.size == COUNT(words));
+  for (size_t i = 0; i < COUNT(words); i++) {
+    const char* w = MappedHashSetGet(&mapped, words[i]);
+    assert(w && w != words[i] && StringEquals(w, words[i]));
+  }
+  assert(!MappedHashSetContains(&mapped, "cow"));
+  MappedHashSetClose(&mapped);
+
+  // A file that isn’t a snapshot.
+  assert(write(fd, "not a snapshot, no sir, not at all", 34) == 34);
+  assert(close(fd) == 0);
+  mapped = HashSetOpenMapped(path, StringHash, (Comparator*)strcmp);
+  assert(mapped.mapping == NULL);
+  assert(unlink(path) == 0);
+  mapped = HashSetOpenMapped(path, StringHash, (Comparator*)strcmp);
+  assert(mapped.mapping == NULL);
+}
+
+static void TestSnapshot() {
+  CheckSnapshot(0);
+  CheckSnapshot(HashSetSmall);
+}
+
+// Example: Freezing a set that will only be queried from now on.
+
+static size_t BadHasher(const void* file_id) {
+  (void)file_id;
+  return 42;
+}
+
+static void CheckFreeze(size_t count, Hasher* hasher) {
+  HashSet set = HashSetNew(count / 2 + 1, hasher, FileIDComparator);
+  FileID* ids = calloc(count, sizeof(FileID));
+  for (size_t i = 0; i < count; i++) {
+    ids[i] = (FileID){.device = 1, .inode = (ino_t)i};
+    HashSetAdd(&set, &ids[i]);
+  }
+  FrozenHashSet frozen = HashSetFreeze(&set);
+  HashSetDelete(&set);
+
+  assert(frozen.size == count);
+  for (size_t i = 0; i < count; i++) {
+    assert(FrozenHashSetGet(&frozen, &(FileID){.device = 1, .inode = i}) ==
+           &ids[i]);
+    assert(!FrozenHashSetContains(&frozen,
+                                  &(FileID){.device = 2, .inode = (ino_t)i}));
+  }
+  // Every element has its own slot, except those that had to overflow.
+  size_t placed = 0;
+  for (size_t i = 0; i < frozen.size; i++) {
+    placed += frozen.elements[i] != NULL;
+  }
+  assert(placed + frozen.overflow.size == count);
+
+  FrozenHashSetDelete(&frozen);
+  free(ids);
+}
+
+static void TestFreeze() {
+  CheckFreeze(0, FileIDHasher);
+  CheckFreeze(1, FileIDHasher);
+  CheckFreeze(100000, FileIDHasher);
+  // Elements with the same hash can’t be separated; they must all overflow.
+  CheckFreeze(100, BadHasher);
+}
+
+// Example: A Bloom filter in front of a set that mostly gets lookups of absent
+// elements. `CountingComparator` counts how often we have to look at elements.
+
+static size_t comparisons;
+
+static int CountingComparator(const void* a, const void* b) {
+  comparisons++;
+  return FileIDComparator(a, b);
+}
+
+static void TestFilter() {
+  HashSet set = HashSetNew(500, FileIDHasher, CountingComparator);
+  static FileID ids[1000];
+  for (ino_t i = 0; i < COUNT(ids) / 2; i++) {
+    ids[i] = (FileID){.device = 1, .inode = i};
+    HashSetAdd(&set, &ids[i]);
+  }
+  HashSetBuildFilter(&set);
+  // Elements added after building the filter are in it, too.
+  for (ino_t i = COUNT(ids) / 2; i < COUNT(ids); i++) {
+    ids[i] = (FileID){.device = 1, .inode = i};
+    HashSetAdd(&set, &ids[i]);
+  }
+
+  for (ino_t i = 0; i < COUNT(ids); i++) {
+    assert(HashSetContains(&set, &ids[i]));
+  }
+  // (These don’t have the same hashes as any elements in the set.)
+  comparisons = 0;
+  for (ino_t i = 1000000; i < 1010000; i++) {
+    assert(!HashSetContains(&set, &(FileID){.device = 2, .inode = i}));
+  }
+  // Without the filter, each of these lookups would walk a list of about 2.
+  assert(comparisons < 1000);
+
+  // Removed elements are still in the filter, but not in the set.
+  for (ino_t i = 0; i < COUNT(ids); i += 2) {
+    HashSetRemove(&set, &ids[i]);
+  }
+  for (ino_t i = 0; i < COUNT(ids); i++) {
+    assert(HashSetContains(&set, &ids[i]) == (i % 2 == 1));
+  }
+  HashSetBuildFilter(&set);
+  for (ino_t i = 0; i < COUNT(ids); i++) {
+    assert(HashSetContains(&set, &ids[i]) == (i % 2 == 1));
+  }
+  HashSetDelete(&set);
+}
+
+// Example: `CallocHuge` allocations are zeroed and aligned, whether or not they
+// are big enough for huge pages.
+
+static void TestCallocHuge() {
+  const size_t default_threshold = HugePageThreshold;
+  HugePageThreshold = 1 << 20;
+  const size_t counts[] = {0, 1, 1000, 3 << 20};
+  for (size_t i = 0; i < COUNT(counts); i++) {
+    unsigned char* p = CallocHuge(counts[i], 1);
+    assert(p && (uintptr_t)p % 64 == 0);
+    if (counts[i] >= HugePageThreshold) {
+      assert((uintptr_t)p % (2 << 20) == 0);
+    }
+    for (size_t j = 0; j < counts[i]; j += 4093) {
+      assert(p[j] == 0);
+      p[j] = 1;
+    }
+    FreeHuge(p);
+  }
+  FreeHuge(NULL);
+  assert(CallocHuge(SIZE_MAX / 2, 4) == NULL);
+  HugePageThreshold = default_threshold;
+}
+
+// Example: A `CuckooSet`, which has the same interface as `HashSet`.
+
+static void TestCuckoo() {
+  // Start small, to exercise evictions, the stash, and growth.
+  CuckooSet set = CuckooSetNew(2, FileIDHasher, FileIDComparator);
+  assert(set.count == 2);
+  static FileID ids[10000];
+  for (ino_t i = 0; i < COUNT(ids); i++) {
+    ids[i] = (FileID){.device = 1, .inode = i};
+    CuckooSetAdd(&set, &ids[i]);
+  }
+  assert(set.size == COUNT(ids));
+  assert(set.overflow.size == 0);
+  assert(set.size <= set.count * CuckooSlots + set.stash_size);
+  for (ino_t i = 0; i < COUNT(ids); i++) {
+    assert(CuckooSetGet(&set, &(FileID){.device = 1, .inode = i}) == &ids[i]);
+    assert(!CuckooSetContains(&set, &(FileID){.device = 2, .inode = i}));
+  }
+
+  // Adding a matching element replaces the old one.
+  FileID replacement = {.device = 1, .inode = 5, .value = "new"};
+  CuckooSetAdd(&set, &replacement);
+  assert(set.size == COUNT(ids));
+  assert(CuckooSetGet(&set, &ids[5]) == &replacement);
+
+  for (ino_t i = 0; i < COUNT(ids); i += 2) {
+    CuckooSetRemove(&set, &ids[i]);
+  }
+  CuckooSetRemove(&set, &(FileID){.device = 3});
+  assert(set.size == COUNT(ids) / 2);
+  size_t count = 0;
+  CuckooSetIterator it = CuckooSetIteratorNew(&set);
+  FileID* id;
+  while ((id = CuckooSetIteratorNext(&it))) {
+    assert(id->inode % 2 == 1);
+    count++;
+  }
+  assert(count == COUNT(ids) / 2);
+  CuckooSetDelete(&set);
+}
+
+// Example: A `CuckooSet` with a `Hasher` that gives every element the same
+// hash keeps working, without growing without bound.
+
+static void TestCuckooCollisions() {
+  CuckooSet set = CuckooSetNew(2, BadHasher, FileIDComparator);
+  static FileID ids[1000];
+  for (ino_t i = 0; i < COUNT(ids); i++) {
+    ids[i] = (FileID){.device = 1, .inode = i};
+    CuckooSetAdd(&set, &ids[i]);
+  }
+  assert(set.size == COUNT(ids));
+  assert(set.count <= 8);
+  assert(set.overflow.size > 0);
+  for (ino_t i = 0; i < COUNT(ids); i++) {
+    assert(CuckooSetGet(&set, &(FileID){.device = 1, .inode = i}) == &ids[i]);
+    assert(!CuckooSetContains(&set, &(FileID){.device = 2, .inode = i}));
+  }
+
+  FileID replacement = {.device = 1, .inode = 999, .value = "new"};
+  CuckooSetAdd(&set, &replacement);
+  assert(set.size == COUNT(ids));
+  assert(CuckooSetGet(&set, &ids[999]) == &replacement);
+
+  for (ino_t i = 0; i < COUNT(ids); i += 2) {
+    CuckooSetRemove(&set, &ids[i]);
+  }
+  assert(set.size == COUNT(ids) / 2);
+  size_t count = 0;
+  CuckooSetIterator it = CuckooSetIteratorNew(&set);
+  for (FileID* id; (id = CuckooSetIteratorNext(&it)); count++) {
+    assert(id->inode % 2 == 1);
+  }
+  assert(count == COUNT(ids) / 2);
+  CuckooSetDelete(&set);
+}
+
+DEFINE_SET_OPERATIONS(ChunkedSet);
+DEFINE_SET_OPERATIONS(CompactSet);
+DEFINE_SET_OPERATIONS(InlineSet);
+DEFINE_SET_OPERATIONS(RobinHoodSet);
+
+enum { ChurnElements = 2000 };
+
+// Applies the same random adds and removes to `set` and to a `HashSet`, and
+// checks that they end up with the same elements. Then checks that adding an
+// element equal to one already present replaces it.
+static void CheckChurn(const SetOperations* operations, void* set) {
+  HashSet expected = HashSetNew(1000, FileIDHasher, FileIDComparator);
+  static FileID ids[ChurnElements];
+  for (ino_t i = 0; i < COUNT(ids); i++) {
+    ids[i] = (FileID){.device = 1, .inode = i};
+  }
+
+  size_t random = 1;
+  for (size_t round = 0; round < 100000; round++) {
+    random = MixHash(random);
+    FileID* id = &ids[random % COUNT(ids)];
+    if (random & (1U << 20)) {
+      operations->add(set, id);
+      HashSetAdd(&expected, id);
+    } else {
+      operations->remove(set, id);
+      HashSetRemove(&expected, id);
+    }
+  }
+  assert(operations->size(set) == expected.size);
+  for (ino_t i = 0; i < COUNT(ids); i++) {
+    assert((operations->get(set, &ids[i]) != NULL) ==
+           HashSetContains(&expected, &ids[i]));
+    assert(!operations->get(set, &(FileID){.device = 2, .inode = i}));
+  }
+  assert(operations->iterate(set) == expected.size);
+
+  static FileID replacement;
+  replacement = ids[7];
+  operations->add(set, &replacement);
+  assert(operations->get(set, &ids[7]) == &replacement);
+
+  HashSetDelete(&expected);
+}
+
+// Example: A `RobinHoodSet` under heavy churn, checked against a `HashSet`.
+
+static void TestRobinHood() {
+  RobinHoodSet set = RobinHoodSetNew(4, FileIDHasher, FileIDComparator);
+  CheckChurn(&RobinHoodSetOperations, &set);
+
+  // Probe sequences stay in order of distance from their homes, and there are
+  // no gaps in them.
+  for (size_t i = 0; i < set.count; i++) {
+    const RobinHoodSlot* s = &set.slots[i];
+    const RobinHoodSlot* previous = &set.slots[(i + set.count - 1) % set.count];
+    if (s->element && s->distance > 0) {
+      assert(previous->element && previous->distance + 1 >= s->distance);
+    }
+  }
+  RobinHoodSetDelete(&set);
+
+  // Even the smallest tables keep a slot empty.
+  set = RobinHoodSetNew(2, FileIDHasher, FileIDComparator);
+  static FileID ids[7];
+  for (ino_t i = 0; i < COUNT(ids); i++) {
+    ids[i] = (FileID){.device = 1, .inode = i};
+    RobinHoodSetAdd(&set, &ids[i]);
+    assert(set.size < set.count);
+  }
+  RobinHoodSetDelete(&set);
+}
+
+// Example: A `ChunkedSet` behaves like a `HashSet`, through heavy churn, even
+// when its buckets span several nodes.
+
+static void TestChunked() {
+  ChunkedSet set = ChunkedSetNew(50, FileIDHasher, FileIDComparator);
+  CheckChurn(&ChunkedSetOperations, &set);
+
+  // Only the last node in each bucket has empty slots.
+  for (size_t i = 0; i < set.count; i++) {
+    for (ChunkedElements* c = set.buckets[i]; c; c = c->next) {
+      assert(c->length > 0);
+      assert(c->next == NULL || c->length == ChunkSlots);
+    }
+  }
+
+  ChunkedSetDelete(&set);
+}
+
+// Example: The tags of a `ChunkedSet` filter out most comparisons, even with a
+// `Hasher` (like `FileIDHasher`, for small inodes) whose high bits are all 0.
+
+static void TestChunkedTags() {
+  ChunkedSet set = ChunkedSetNew(1, FileIDHasher, CountingComparator);
+  static FileID ids[12];
+  for (ino_t i = 0; i < COUNT(ids); i++) {
+    ids[i] = (FileID){.device = 1, .inode = i};
+    ChunkedSetAdd(&set, &ids[i]);
+  }
+  comparisons = 0;
+  for (ino_t i = 1; i <= 1000; i++) {
+    assert(!ChunkedSetContains(&set, &(FileID){.device = 1000, .inode = i}));
+  }
+  // Without tags, each miss would compare all 12 elements.
+  assert(comparisons < 1000 * COUNT(ids) / 4);
+  ChunkedSetDelete(&set);
+}
+
+// Example: A `CompactSet` behaves like a `HashSet`, and reuses the nodes of
+// removed elements.
+
+static void TestCompact() {
+  CompactSet set = CompactSetNew(500, FileIDHasher, FileIDComparator);
+  CheckChurn(&CompactSetOperations, &set);
+
+  // The pool never holds more nodes than the set ever had elements at once.
+  assert(set.pool_size <= ChurnElements + 1);
+
+  CompactSetDelete(&set);
+}
+
+// Example: The tags of a `CompactSet` filter out most comparisons, even with a
+// `Hasher` (like `FileIDHasher`, for small inodes) whose high bits are all 0.
+
+static void TestCompactTags() {
+  CompactSet set = CompactSetNew(1, FileIDHasher, CountingComparator);
+  static FileID ids[12];
+  for (ino_t i = 0; i < COUNT(ids); i++) {
+    ids[i] = (FileID){.device = 1, .inode = i};
+    CompactSetAdd(&set, &ids[i]);
+  }
+  comparisons = 0;
+  for (ino_t i = 1; i <= 1000; i++) {
+    assert(!CompactSetContains(&set, &(FileID){.device = 1000, .inode = i}));
+  }
+  // Without tags, each miss would compare all 12 elements.
+  assert(comparisons < 1000 * COUNT(ids) / 4);
+  CompactSetDelete(&set);
+}
+
+// Example: An `InlineSet` behaves like a `HashSet`, and allocates only for
+// collisions.
+
+static void CheckInline(size_t options) {
+  InlineSet set =
+      InlineSetNewWithOptions(500, FileIDHasher, FileIDComparator, options);
+  CheckChurn(&InlineSetOperations, &set);
+
+  // Empty buckets have no list.
+  for (size_t i = 0; i < set.count; i++) {
+    assert(set.buckets[i].element || set.buckets[i].next == NULL);
+  }
+
+  InlineSetDelete(&set);
+}
+
+static void TestInline() {
+  CheckInline(0);
+  CheckInline(InlineSetTagged);
+}
+
+// Example: An overloaded set whose lists are kept sorted, so that lookups of
+// absent elements stop early.
+
+static int CountingItemCompare(const void* a, const void* b) {
+  comparisons++;
+  return ItemCompare(a, b);
+}
+
+// Returns the number of comparisons needed to look up absent elements in a set
+// of 1000 `Item`s in 10 buckets.
+static size_t CountMissComparisons(size_t options) {
+  HashSet set = HashSetNewWithOptions(10, ItemHash, CountingItemCompare,
+                                      options);
+  static Item items[1000];
+  for (size_t i = 0; i < COUNT(items); i++) {
+    // Add them in a scrambled order.
+    items[i] = (Item){.index = i * 7919 % COUNT(items) * 20};
+    HashSetAdd(&set, &items[i]);
+  }
+  for (size_t i = 0; i < COUNT(items); i += 3) {
+    HashSetRemove(&set, &items[i]);
+  }
+  for (size_t i = 0; i < COUNT(items); i++) {
+    assert(HashSetContains(&set, &items[i]) == (i % 3 != 0));
+  }
+
+  if (options & HashSetSorted) {
+    for (size_t i = 0; i < set.count; i++) {
+      for (HashSetElements* e = set.elements[i]; e && e->next; e = e->next) {
+        assert(ItemCompare(e->element, e->next->element) < 0);
+      }
+    }
+  }
+
+  comparisons = 0;
+  for (size_t i = 0; i < COUNT(items); i++) {
+    assert(!HashSetContains(&set, &(Item){.index = items[i].index + 10}));
+  }
+  HashSetDelete(&set);
+  return comparisons;
+}
+
+static void TestSorted() {
+  const size_t unsorted = CountMissComparisons(0);
+  const size_t sorted = CountMissComparisons(HashSetSorted);
+  assert(sorted < unsorted * 2 / 3);
+}
+
+// Example: With a `Hasher` that puts everything in 1 bucket, a treeified set
+// still finds elements in a logarithmic number of comparisons.
+
+static size_t CollidingItemHash(const void* item) {
+  (void)item;
+  return 0;
+}
+
+static void TestTreeify() {
+  HashSet set = HashSetNewWithOptions(16, CollidingItemHash,
+                                      CountingItemCompare, HashSetTreeify);
+  static Item items[1024];
+  for (size_t i = 0; i < COUNT(items); i++) {
+    items[i] = (Item){.index = i * 7919 % COUNT(items) * 2};
+    HashSetAdd(&set, &items[i]);
+  }
+  assert(set.size == COUNT(items));
+  assert(CountElements(&set) == COUNT(items));
+
+  comparisons = 0;
+  for (size_t i = 0; i < COUNT(items); i++) {
+    assert(HashSetGet(&set, &(Item){.index = items[i].index}) == &items[i]);
+    assert(!HashSetContains(&set, &(Item){.index = items[i].index + 1}));
+  }
+  // An AVL tree of 1024 nodes is at most 14 levels deep.
+  assert(comparisons <= 2 * COUNT(items) * 14);
+
+  Item replacement = items[5];
+  HashSetAdd(&set, &replacement);
+  assert(set.size == COUNT(items));
+  assert(HashSetGet(&set, &items[5]) == &replacement);
+
+  // Removing most of the elements turns the tree back into a sorted list.
+  for (size_t i = 0; i < COUNT(items) - 3; i++) {
+    HashSetRemove(&set, &items[i]);
+    assert(set.size == COUNT(items) - i - 1);
+  }
+  assert(CountElements(&set) == 3);
+  for (HashSetElements* e = set.elements[0]; e->next; e = e->next) {
+    assert(ItemCompare(e->element, e->next->element) < 0);
+  }
+  for (size_t i = 0; i < COUNT(items); i++) {
+    assert(HashSetContains(&set, &items[i]) == (i >= COUNT(items) - 3));
+  }
+  HashSetDelete(&set);
+}
+
+// Example: In a tagged `InlineSet`, lookups skip elements whose tags differ
+// from that of the element sought, without comparing them. This works even
+// with a `Hasher` (like `FileIDHasher`, for small inodes) whose high bits are
+// all 0.
+
+static void TestInlineTagged() {
+  InlineSet set = InlineSetNewWithOptions(1, FileIDHasher, CountingComparator,
+                                          InlineSetTagged);
+  static FileID ids[100];
+  for (ino_t i = 0; i < COUNT(ids); i++) {
+    ids[i] = (FileID){.device = 1, .inode = i};
+    InlineSetAdd(&set, &ids[i]);
+  }
+
+  comparisons = 0;
+  for (ino_t i = 0; i < COUNT(ids); i++) {
+    assert(InlineSetGet(&set, &(FileID){.device = 1, .inode = i}) == &ids[i]);
+    assert(!InlineSetContains(&set,
+                              &(FileID){.device = 1000, .inode = i + 1}));
+  }
+  // Without tags, this would be thousands.
+  assert(comparisons <= COUNT(ids) + COUNT(ids) / 10);
+
+  InlineSetIterator it = InlineSetIteratorNew(&set);
+  for (FileID* id; (id = InlineSetIteratorNext(&it));) {
+    assert(id >= ids && id < ids + COUNT(ids));
+  }
+  InlineSetRemove(&set, &ids[0]);
+  InlineSetRemove(&set, &ids[50]);
+  assert(set.size == COUNT(ids) - 2);
+  assert(!InlineSetContains(&set, &ids[0]));
+  assert(InlineSetGet(&set, &ids[1]) == &ids[1]);
+  InlineSetDelete(&set);
+}
+
+// Example: Small sets, like the one in `TestDictionary`, need no allocations
+// until they outgrow `HashSetSmallSize`.
+
+static void TestSmall() {
+  HashSet set = HashSetNewWithOptions(10, ItemHash, ItemCompare, HashSetSmall);
+  static Item items[HashSetSmallSize * 4];
+  for (size_t i = 0; i < COUNT(items); i++) {
+    items[i] = (Item){.index = i};
+  }
+  for (size_t i = 0; i < HashSetSmallSize; i++) {
+    HashSetAdd(&set, &items[i]);
+  }
+  assert(set.elements == NULL);
+  assert(set.size == HashSetSmallSize);
+  assert(CountElements(&set) == HashSetSmallSize);
+
+  // The elements are in the `HashSet` itself, with nothing allocated: a copy
+  // of the struct is an independent set.
+  assert((char*)set.small >= (char*)&set &&
+         (char*)&set.small[HashSetSmallSize] <= (char*)(&set + 1));
+  HashSet copy = set;
+  HashSetRemove(&copy, &items[1]);
+  assert(!HashSetContains(&copy, &items[1]));
+  assert(HashSetContains(&set, &items[1]));
+  assert(CountElements(&set) == HashSetSmallSize);
+
+  Item replacement = items[3];
+  HashSetAdd(&set, &replacement);
+  assert(set.size == HashSetSmallSize);
+  assert(HashSetGet(&set, &items[3]) == &replacement);
+  HashSetRemove(&set, &items[0]);
+  assert(!HashSetContains(&set, &items[0]));
+  assert(HashSetContains(&set, &items[1]));
+  HashSetAdd(&set, &items[0]);
+
+  // Iterating a range of buckets finds only the small elements that belong to
+  // them.
+  size_t count = 0;
+  for (size_t i = 0; i < set.count; i++) {
+    HashSetIterator it = HashSetIteratorNewRange(&set, i, i + 1);
+    for (Item* item; (item = HashSetIteratorNext(&it)); count++) {
+      assert(ItemHash(item) % set.count == i);
+    }
+  }
+  assert(count == set.size);
+
+  // The set operations work on small sets, and with large ones.
+  HashSet large = HashSetNew(10, ItemHash, ItemCompare);
+  for (size_t i = HashSetSmallSize / 2; i < COUNT(items); i++) {
+    HashSetAdd(&large, &items[i]);
+  }
+  HashSet intersection = HashSetIntersect(&set, &large);
+  assert(intersection.size == HashSetSmallSize / 2);
+  HashSet either = HashSetUnion(&set, &large);
+  assert(either.size == COUNT(items));
+  HashSetDelete(&intersection);
+  HashSetDelete(&either);
+  HashSetDelete(&large);
+
+  // Outgrowing the small storage allocates the buckets.
+  for (size_t i = HashSetSmallSize; i < COUNT(items); i++) {
+    HashSetAdd(&set, &items[i]);
+  }
+  assert(set.elements != NULL);
+  assert(CountElements(&set) == COUNT(items));
+  for (size_t i = 0; i < COUNT(items); i++) {
+    assert(HashSetGet(&set, &items[i]) == (i == 3 ? &replacement : &items[i]));
+  }
+  HashSetDelete(&set);
+
+  // The filter shares space with the small elements, so building one
+  // allocates the buckets.
+  set = HashSetNewWithOptions(10, ItemHash, ItemCompare, HashSetSmall);
+  HashSetAdd(&set, &items[0]);
+  HashSetBuildFilter(&set);
+  assert(set.elements != NULL && set.filter != NULL);
+  assert(HashSetContains(&set, &items[0]));
+  assert(!HashSetContains(&set, &items[1]));
+  HashSetDelete(&set);
+}
+
+// Example: A bounded set used as a cache keeps the elements that are used
+// often, and tells us about the ones it evicts.
+
+static void CountEviction(void* element, void* context) {
+  Item* item = element;
+  size_t* evictions = context;
+  item->word = "evicted";
+  (*evictions)++;
+}
+
+static void TestBounded() {
+  size_t evictions = 0;
+  HashSet set = HashSetNewBounded(64, ItemHash, ItemCompare, 100,
+                                  CountEviction, &evictions);
+  static Item items[1000];
+  for (size_t i = 0; i < COUNT(items); i++) {
+    items[i] = (Item){.index = i};
+    HashSetAdd(&set, &items[i]);
+    assert(set.size <= 100);
+    // Items 0 through 9 are hot.
+    for (size_t j = 0; j < 10 && j <= i; j++) {
+      assert(HashSetGet(&set, &items[j]) == &items[j]);
+    }
+  }
+  assert(set.size == 100);
+  assert(evictions == COUNT(items) - 100);
+  assert(CountElements(&set) == 100);
+  for (size_t i = 0; i < COUNT(items); i++) {
+    assert(HashSetContains(&set, &items[i]) == (items[i].word == NULL));
+  }
+
+  // Replacing an element doesn’t evict anything.
+  Item replacement = items[COUNT(items) - 1];
+  HashSetAdd(&set, &replacement);
+  assert(evictions == COUNT(items) - 100);
+  HashSetRemove(&set, &items[0]);
+  assert(set.size == 99);
+  assert(evictions == COUNT(items) - 100);
+  HashSetDelete(&set);
+}
+
+// Example: Session-like elements that expire, reaped a few buckets at a time.
+
+static uint64_t fake_time;
+
+static uint64_t FakeClock(void) {
+  return fake_time;
+}
+
+static void TestExpiring() {
+  size_t evictions = 0;
+  HashSet set = HashSetNewExpiring(32, ItemHash, ItemCompare, FakeClock,
+                                   CountEviction, &evictions);
+  static Item items[200];
+  fake_time = 0;
+  for (size_t i = 0; i < COUNT(items); i++) {
+    items[i] = (Item){.index = i};
+    if (i < 100) {
+      HashSetAddWithExpiry(&set, &items[i], i + 1);
+    } else {
+      HashSetAdd(&set, &items[i]);
+    }
+  }
+
+  // Items 0 through 49 expire, lazily.
+  fake_time = 50;
+  for (size_t i = 0; i < COUNT(items); i++) {
+    assert(HashSetContains(&set, &items[i]) == (i >= 50));
+  }
+  size_t count = 0;
+  HashSetIterator it = HashSetIteratorNew(&set);
+  for (Item* item; (item = HashSetIteratorNext(&it)); count++) {
+    assert(item->index >= 50);
+  }
+  assert(count == 150);
+  assert(set.size == COUNT(items));
+  assert(evictions == 0);
+
+  // Re-adding an expired element revives it.
+  HashSetAddWithExpiry(&set, &items[0], 1000);
+  assert(HashSetContains(&set, &items[0]));
+
+  // Each call reaps only a few buckets.
+  size_t reaped = 0;
+  for (size_t i = 0; i < set.count; i++) {
+    reaped += HashSetReapExpired(&set, 1);
+    assert(reaped <= 49);
+  }
+  assert(reaped == 49);
+  assert(evictions == 49);
+  assert(set.size == 151);
+  assert(CountElements(&set) == 151);
+  assert(HashSetReapExpired(&set, set.count) == 0);
+  HashSetDelete(&set);
+}
+
+// Example: Replacing an expiring element with `HashSetAdd` makes it permanent,
+// and snapshots and frozen copies leave out expired elements that have not yet
+// been reaped.
+
+static void TestExpiringReplacement() {
+  static char* words[] = {"cat", "dog", "emu"};
+  HashSet set = HashSetNewExpiring(4, StringHash, (Comparator*)strcmp,
+                                   FakeClock, NULL, NULL);
+  fake_time = 0;
+  HashSetAddWithExpiry(&set, words[0], 5);
+  HashSetAddWithExpiry(&set, words[1], 5);
+  HashSetAddWithExpiry(&set, words[2], 100);
+  fake_time = 10;
+  assert(!HashSetContains(&set, "cat"));
+  static char cat[] = "cat";
+  HashSetAdd(&set, cat);
+  assert(HashSetGet(&set, "cat") == cat);
+  fake_time = 1000;
+  assert(HashSetContains(&set, "cat"));
+  assert(!HashSetContains(&set, "emu"));
+  assert(set.size == 3);
+
+  char path[] = "/tmp/hashset-snapshot-XXXXXX";
+  const int fd = mkstemp(path);
+  assert(fd >= 0);
+  assert(close(fd) == 0);
+  assert(HashSetSave(&set, path, StringSize));
+  MappedHashSet mapped =
+      HashSetOpenMapped(path, StringHash, (Comparator*)strcmp);
+  assert(mapped.mapping);
+  assert(mapped.size == 1);
+  assert(MappedHashSetContains(&mapped, "cat"));
+  assert(!MappedHashSetContains(&mapped, "dog"));
+  MappedHashSetClose(&mapped);
+  assert(unlink(path) == 0);
+
+  FrozenHashSet frozen = HashSetFreeze(&set);
+  assert(frozen.size == 1);
+  assert(FrozenHashSetGet(&frozen, "cat") == cat);
+  assert(!FrozenHashSetContains(&frozen, "dog"));
+  assert(!FrozenHashSetContains(&frozen, "emu"));
+  FrozenHashSetDelete(&frozen);
+  HashSetDelete(&set);
+}
+
+// Example: A full cache whose expired elements have not been reaped makes room
+// by reaping them, not by evicting live ones.
+
+static void TestBoundedExpiring() {
+  size_t evictions = 0;
+  HashSet set = HashSetNewBounded(64, ItemHash, ItemCompare, 100,
+                                  CountEviction, &evictions);
+  set.clock = FakeClock;
+  fake_time = 0;
+  static Item items[150];
+  for (size_t i = 0; i < COUNT(items); i++) {
+    items[i] = (Item){.index = i};
+  }
+  // The odd ones among the first 100 expire.
+  for (size_t i = 0; i < 100; i++) {
+    HashSetAddWithExpiry(&set, &items[i], i % 2 ? 5 : 1000);
+  }
+  fake_time = 10;
+  for (size_t i = 100; i < COUNT(items); i++) {
+    HashSetAdd(&set, &items[i]);
+    assert(set.size <= 100);
+  }
+  assert(evictions == 50);
+  for (size_t i = 0; i < COUNT(items); i++) {
+    assert(HashSetContains(&set, &items[i]) == (i >= 100 || i % 2 == 0));
+  }
+
+  // Once nothing has expired, the CLOCK hand evicts as usual.
+  HashSetAdd(&set, &(Item){.index = 1000});
+  assert(set.size == 100);
+  assert(evictions == 51);
+  HashSetDelete(&set);
+}
+
+// Example: Several threads counting occurrences of keys at once, with 1 very
+// hot key.
+
+enum { CounterThreads = 4, CounterKeys = 100, CounterRounds = 50000 };
+
+typedef struct CountingThread {
+  CounterMap* map;
+  Item* keys;
+  size_t seed;
+  // How many times this thread added to each key.
+  uint64_t expected[CounterKeys];
+} CountingThread;
+
+static void* CountKeys(void* thread) {
+  CountingThread* t = thread;
+  for (size_t i = 0; i < CounterRounds; i++) {
+    const size_t k = MixHash(t->seed + i) % CounterKeys;
+    CounterMapAdd(t->map, &t->keys[k], 1);
+    CounterMapAdd(t->map, &t->keys[0], 2);
+    t->expected[k]++;
+    t->expected[0] += 2;
+  }
+  return NULL;
+}
+
+typedef struct HandoffThread {
+  CounterMap* map;
+  Item* key;
+} HandoffThread;
+
+static void* AddOnce(void* thread) {
+  HandoffThread* t = thread;
+  CounterMapAdd(t->map, t->key, 1);
+  return NULL;
+}
+
+static void TestCounterMap() {
+  CounterMap map = CounterMapNew(16, ItemHash, ItemCompare);
+  static Item keys[CounterKeys];
+  for (size_t i = 0; i < CounterKeys; i++) {
+    keys[i] = (Item){.index = i};
+  }
+  CounterMapSplit(&map, &keys[1]);
+
+  static CountingThread threads[CounterThreads];
+  pthread_t ids[CounterThreads];
+  for (size_t i = 0; i < CounterThreads; i++) {
+    threads[i] = (CountingThread){.map = &map, .keys = keys, .seed = i << 32};
+    assert(pthread_create(&ids[i], NULL, CountKeys, &threads[i]) == 0);
+  }
+  for (size_t i = 0; i < CounterThreads; i++) {
+    assert(pthread_join(ids[i], NULL) == 0);
+  }
+
+  assert(atomic_load_explicit(&map.size, memory_order_relaxed) == CounterKeys);
+  for (size_t k = 0; k < CounterKeys; k++) {
+    uint64_t expected = 0;
+    for (size_t i = 0; i < CounterThreads; i++) {
+      expected += threads[i].expected[k];
+    }
+    assert(CounterMapGet(&map, &keys[k]) == expected);
+  }
+  assert(CounterMapGet(&map, &(Item){.index = CounterKeys}) == 0);
+
+  uint64_t total = 0;
+  size_t count = 0;
+  CounterMapIterator it = CounterMapIteratorNew(&map);
+  uint64_t value;
+  while (CounterMapIteratorNext(&it, &value)) {
+    total += value;
+    count++;
+  }
+  assert(count == CounterKeys);
+  assert(total == 3 * CounterThreads * CounterRounds);
+
+  // A key whose increments keep passing between threads gets split, even if
+  // they never race.
+  Item handoff = {.index = CounterKeys};
+  HandoffThread thread = {.map = &map, .key = &handoff};
+  for (size_t i = 0; i < 100; i++) {
+    CounterMapAdd(&map, &handoff, 1);
+    pthread_t id;
+    assert(pthread_create(&id, NULL, AddOnce, &thread) == 0);
+    assert(pthread_join(id, NULL) == 0);
+  }
+  const Counter* c = atomic_load_explicit(
+      &map.buckets[ItemHash(&handoff) % map.count], memory_order_acquire);
+  assert(c->key == &handoff);
+  assert(atomic_load_explicit(&c->shards, memory_order_acquire) != NULL);
+  assert(CounterMapGet(&map, &handoff) == 200);
+  CounterMapDelete(&map);
+}
+
+// Example: Interning strings, so that equal strings have the same address.
+
+static void TestInterner() {
+  StringInterner interner = StringInternerNew(100);
+  char buffer[32];
+  const char* canonical[1000];
+  for (size_t i = 0; i < COUNT(canonical); i++) {
+    const int length = snprintf(buffer, sizeof(buffer), "string %zu", i);
+    canonical[i] = StringInternerIntern(&interner, buffer, (size_t)length);
+    assert(StringEquals(canonical[i], buffer));
+    assert(canonical[i] != buffer);
+  }
+  for (size_t i = 0; i < COUNT(canonical); i++) {
+    const int length = snprintf(buffer, sizeof(buffer), "string %zu", i);
+    assert(StringInternerIntern(&interner, buffer, (size_t)length) ==
+           canonical[i]);
+    assert(StringInternerGet(&interner, buffer, (size_t)length) ==
+           canonical[i]);
+  }
+  assert(interner.set.size == COUNT(canonical));
+
+  // Only the given bytes count: a prefix is a different string.
+  assert(StringInternerGet(&interner, "string 12", 8) == canonical[1]);
+  assert(StringInternerGet(&interner, "string", 6) == NULL);
+
+  // Strings larger than an arena block, and empty strings, work too. A large
+  // string does not use up the current block.
+  const ArenaBlock* block = interner.block;
+  const size_t used = interner.used;
+  const size_t huge_length = 3 << 20;
+  char* huge = calloc(huge_length, 1);
+  memset(huge, 'x', huge_length);
+  const char* h = StringInternerIntern(&interner, huge, huge_length);
+  assert(h != huge && memcmp(h, huge, huge_length) == 0 && !h[huge_length]);
+  assert(StringInternerIntern(&interner, huge, huge_length) == h);
+  free(huge);
+  assert(interner.block == block && interner.used == used);
+  const char* empty = StringInternerIntern(&interner, NULL, 0);
+  assert(StringEquals(empty, ""));
+  assert(interner.block == block && interner.used > used);
+  assert(StringInternerGet(&interner, "nope", 0) == empty);
+  assert(StringInternerGet(&interner, NULL, 0) == empty);
+  assert(StringInternerIntern(&interner, "", 0) == empty);
+
+  // So does a large string in a new interner, before any block.
+  StringInterner other = StringInternerNew(10);
+  const size_t large_length = 2 << 20;
+  char* large = calloc(large_length, 1);
+  memset(large, 'y', large_length);
+  const char* l = StringInternerIntern(&other, large, large_length);
+  assert(memcmp(l, large, large_length) == 0);
+  assert(StringEquals(StringInternerIntern(&other, "small", 5), "small"));
+  assert(StringInternerGet(&other, large, large_length) == l);
+  free(large);
+  StringInternerDelete(&other);
+
+  StringInternerDelete(&interner);
+}
+
+// Example: Loading a word list straight from a file, without copying it.
+
+static void TestLoadLines() {
+  char path[] = "/tmp/hashset-lines-XXXXXX";
+  const int fd = mkstemp(path);
+  assert(fd >= 0);
+  const char text[] = "cat\ndog\n\ncow\ndog\nlast line";
+  assert(write(fd, text, sizeof(text) - 1) == sizeof(text) - 1);
+  assert(close(fd) == 0);
+
+  LineSet lines;
+  assert(HashSetLoadLines(path, &lines));
+  assert(lines.count == 6);
+  assert(lines.set.size == 5);
+  assert(HashSetContains(&lines.set, &(StringView){"cat", 3}));
+  assert(HashSetContains(&lines.set, &(StringView){"", 0}));
+  assert(HashSetContains(&lines.set, &(StringView){"last line", 9}));
+  assert(!HashSetContains(&lines.set, &(StringView){"ca", 2}));
+  assert(!HashSetContains(&lines.set, &(StringView){"cat\n", 4}));
+  const StringView* dog = HashSetGet(&lines.set, &(StringView){"dog", 3});
+  assert(dog == &lines.lines[4]);
+  assert(dog->bytes == (char*)lines.mapping + 13);
+  assert(StringViewHash(&(StringView){"cow", 3}) == StringHash("cow"));
+  LineSetClose(&lines);
+
+  // An empty file has no lines; a missing file is an error.
+  assert(truncate(path, 0) == 0);
+  assert(HashSetLoadLines(path, &lines));
+  assert(lines.count == 0 && lines.set.size == 0);
+  LineSetClose(&lines);
+  assert(unlink(path) == 0);
+  assert(!HashSetLoadLines(path, &lines));
+}
+
+// Example: Tracing the operations on a set, for replay.c to replay. A `Word`’s
+// key part is behind a pointer, so the trace records the bytes it points to.
+
+static size_t WordKeyBytes(const void* word, const void** bytes) {
+  const Word* w = word;
+  *bytes = w->word;
+  return strlen(w->word);
+}
+
+static void TestTrace() {
+  HashSet set = HashSetNew(10, WordHash, WordCompare);
+  Word cat = {.word = "cat"};
+  Word dog = {.word = "dog"};
+  HashSetAdd(&set, &cat);
+
+  char path[] = "/tmp/hashset-trace-XXXXXX";
+  const int fd = mkstemp(path);
+  assert(fd >= 0);
+  TraceWriter writer;
+  assert(HashSetTraceStart(&set, path, WordKeyBytes, &writer));
+  HashSetAdd(&set, &dog);
+  assert(!HashSetContains(&set, &(Word){.word = "cow"}));
+  HashSetIterator it = HashSetIteratorNew(&set);
+  size_t count = 0;
+  while (HashSetIteratorNext(&it)) {
+    count++;
+  }
+  assert(count == 2);
+  HashSetRemove(&set, &cat);
+  assert(HashSetTraceStop(&set, &writer));
+  // No longer traced.
+  HashSetAdd(&set, &cat);
+  HashSetDelete(&set);
+
+  Trace trace = TraceOpen(path);
+  assert(trace.mapping);
+  assert(trace.count == 5);
+  const struct {
+    size_t operation;
+    const char* word;
+  } expected[] = {
+      {HashSetTraceAdd, "cat"},    {HashSetTraceAdd, "dog"},
+      {HashSetTraceGet, "cow"},    {HashSetTraceIterate, NULL},
+      {HashSetTraceRemove, "cat"},
+  };
+  for (size_t i = 0; i < COUNT(expected); i++) {
+    const TraceEvent* e = &trace.events[i];
+    assert(e->operation == expected[i].operation);
+    assert(i == 0 || e->time >= e[-1].time);
+    if (expected[i].word) {
+      assert(e->length == strlen(expected[i].word));
+      assert(memcmp(e->bytes, expected[i].word, e->length) == 0);
+      assert(e->hash == StringHash(expected[i].word));
+    } else {
+      assert(e->bytes == NULL);
+    }
+  }
+  TraceClose(&trace);
+
+  // A truncated trace is an error, as is a missing one.
+  assert(truncate(path, 12) == 0);
+  trace = TraceOpen(path);
+  assert(trace.mapping == NULL);
+  assert(close(fd) == 0);
+  assert(unlink(path) == 0);
+  trace = TraceOpen(path);
+  assert(trace.mapping == NULL);
+}
+
+typedef struct ExpectedEvent {
+  size_t operation;
+  const char* word;
+} ExpectedEvent;
+
+// Checks that the trace at `path` holds exactly the `count` `expected` events,
+// of `Word`s, and then deletes it.
+static void CheckTraceEvents(const char* path,
+                             const ExpectedEvent* expected,
+                             size_t count) {
+  Trace trace = TraceOpen(path);
+  assert(trace.mapping);
+  assert(trace.count == count);
+  for (size_t i = 0; i < count; i++) {
+    const TraceEvent* e = &trace.events[i];
+    assert(e->operation == expected[i].operation);
+    assert(e->length == strlen(expected[i].word));
+    assert(memcmp(e->bytes, expected[i].word, e->length) == 0);
+    assert(e->hash == StringHash(expected[i].word));
+  }
+  TraceClose(&trace);
+  assert(unlink(path) == 0);
+}
+
+// Example: A trace of a bounded, expiring set records its evictions and reaps
+// as removes, so that replaying it against an unbounded set keeps the same
+// elements.
+
+static void TestTraceEvictions() {
+  HashSet set = HashSetNewBounded(4, WordHash, WordCompare, 1, NULL, NULL);
+  set.clock = FakeClock;
+  fake_time = 0;
+  Word cat = {.word = "cat"};
+  Word dog = {.word = "dog"};
+
+  char path[] = "/tmp/hashset-trace-XXXXXX";
+  const int fd = mkstemp(path);
+  assert(fd >= 0);
+  assert(close(fd) == 0);
+  TraceWriter writer;
+  assert(HashSetTraceStart(&set, path, WordKeyBytes, &writer));
+  HashSetAddWithExpiry(&set, &cat, 5);
+  HashSetAddWithExpiry(&set, &dog, 5);
+  fake_time = 10;
+  assert(HashSetReapExpired(&set, set.count) == 1);
+  assert(HashSetTraceStop(&set, &writer));
+  HashSetDelete(&set);
+
+  const ExpectedEvent expected[] = {
+      {HashSetTraceAdd, "cat"},
+      {HashSetTraceAdd, "dog"},
+      {HashSetTraceRemove, "cat"},
+      {HashSetTraceRemove, "dog"},
+  };
+  CheckTraceEvents(path, expected, COUNT(expected));
+}
+
+// Example: Routing the same key through several sets that share a `Hasher`,
+// hashing it only once.
+
+static void TestWithHash() {
+  HashSet seen = HashSetNew(10, WordHash, WordCompare);
+  HashSet definitions = HashSetNew(20, WordHash, WordCompare);
+
+  Word cat = {.word = "cat", .definition = "A fine animal indeed"};
+  Word dog = {.word = "dog",
+              .definition = "A friend who likes to play frisbee"};
+
+  size_t hash = WordHash(&cat);
+  HashSetAddWithHash(&seen, &cat, hash);
+  HashSetAddWithHash(&definitions, &cat, hash);
+  hash = WordHash(&dog);
+  HashSetAddWithHash(&seen, &dog, hash);
+  HashSetAddWithHash(&definitions, &dog, hash);
+
+  // The `WithHash` variants must agree with the plain ones.
+  assert(HashSetContains(&seen, &(Word){.word = "cat"}));
+  assert(HashSetContains(&definitions, &(Word){.word = "dog"}));
+  const Word cow = {.word = "cow"};
+  assert(!HashSetContainsWithHash(&seen, &cow, WordHash(&cow)));
+
+  hash = WordHash(&(Word){.word = "cat"});
+  Word* result = HashSetGetWithHash(&definitions, &(Word){.word = "cat"}, hash);
+  assert(StringEquals(result->definition, cat.definition));
+  assert(HashSetContainsWithHash(&seen, &(Word){.word = "cat"}, hash));
+
+  HashSetRemoveWithHash(&seen, &(Word){.word = "cat"}, hash);
+  HashSetRemoveWithHash(&definitions, &(Word){.word = "cat"}, hash);
+  assert(!HashSetContains(&seen, &cat));
+  assert(!HashSetContains(&definitions, &cat));
+  assert(HashSetContains(&definitions, &dog));
+
+  HashSetDelete(&seen);
+  HashSetDelete(&definitions);
+}
+
+// Example: Looking `Word`s up by the bare string, without building a `Word`.
+// `StringHash` already hashes a bare string just as `WordHash` hashes a `Word`.
+
+static int WordKeyCompare(const void* element, const void* key) {
+  const Word* w = element;
+  return strcmp(w->word, key);
+}
+
+static void CheckByKey(size_t options) {
+  // 1 bucket, so that `HashSetTreeify` makes a tree.
+  HashSet set = HashSetNewWithOptions(1, WordHash, WordCompare, options);
+  static char names[64][8];
+  static Word words[COUNT(names)];
+  for (size_t i = 0; i < COUNT(words); i++) {
+    snprintf(names[i], sizeof(names[i]), "w%zu", i * 37 % COUNT(names));
+    words[i] = (Word){.word = names[i]};
+    HashSetAdd(&set, &words[i]);
+  }
+
+  for (size_t i = 0; i < COUNT(words); i++) {
+    assert(HashSetGetByKey(&set, names[i], StringHash, WordKeyCompare) ==
+           &words[i]);
+  }
+  assert(!HashSetContainsByKey(&set, "w64", StringHash, WordKeyCompare));
+  assert(!HashSetContainsByKey(&set, "cat", StringHash, WordKeyCompare));
+
+  for (size_t i = 0; i < COUNT(words); i += 2) {
+    HashSetRemoveByKey(&set, names[i], StringHash, WordKeyCompare);
+  }
+  assert(set.size == COUNT(words) / 2);
+  for (size_t i = 0; i < COUNT(words); i++) {
+    assert(HashSetContainsByKey(&set, names[i], StringHash, WordKeyCompare) ==
+           (i % 2 == 1));
+    assert(HashSetContains(&set, &words[i]) == (i % 2 == 1));
+  }
+  HashSetDelete(&set);
+}
+
+static void TestByKey() {
+  CheckByKey(0);
+  CheckByKey(HashSetSorted);
+  CheckByKey(HashSetTreeify);
+  CheckByKey(HashSetSmall);
+
+  // A set that is still small.
+  HashSet set = HashSetNewWithOptions(10, WordHash, WordCompare, HashSetSmall);
+  Word cat = {.word = "cat"};
+  HashSetAdd(&set, &cat);
+  assert(HashSetGetByKey(&set, "cat", StringHash, WordKeyCompare) == &cat);
+  HashSetRemoveByKey(&set, "cat", StringHash, WordKeyCompare);
+  assert(set.size == 0 && set.elements == NULL);
+  HashSetDelete(&set);
+}
+
+// Example: Set operations, filters, and freezing are not traced as iterations
+// and lookups of a traced set, whichever way they work internally.
+
+static void TestTraceInternalPasses() {
+  HashSet set = HashSetNew(4, WordHash, WordCompare);
+  // A different `count`, so that set operations can’t go bucket by bucket.
+  HashSet other = HashSetNew(7, WordHash, WordCompare);
+  Word cat = {.word = "cat"};
+  Word dog = {.word = "dog"};
+  HashSetAdd(&set, &cat);
+  HashSetAdd(&other, &cat);
+  HashSetAdd(&other, &dog);
+  char path[] = "/tmp/hashset-trace-XXXXXX";
+  const int fd = mkstemp(path);
+  assert(fd >= 0);
+  assert(close(fd) == 0);
+  TraceWriter writer;
+  assert(HashSetTraceStart(&set, path, WordKeyBytes, &writer));
+  HashSetBuildFilter(&set);
+  HashSet results[] = {
+      HashSetUnion(&set, &other),
+      HashSetIntersect(&set, &other),
+      HashSetIntersect(&other, &set),
+      HashSetDifference(&other, &set),
+      HashSetDifference(&set, &other),
+  };
+  for (size_t i = 0; i < COUNT(results); i++) {
+    HashSetDelete(&results[i]);
+  }
+  FrozenHashSet frozen = HashSetFreeze(&set);
+  FrozenHashSetDelete(&frozen);
+  assert(HashSetTraceStop(&set, &writer));
+  HashSetDelete(&set);
+  HashSetDelete(&other);
+
+  const ExpectedEvent expected[] = {{HashSetTraceAdd, "cat"}};
+  CheckTraceEvents(path, expected, COUNT(expected));
+}
+
+// Example: Lookups and removals by key appear in a trace as gets and removes of
+// the elements they find.
+
+static void TestTraceByKey() {
+  HashSet set = HashSetNew(4, WordHash, WordCompare);
+  Word cat = {.word = "cat"};
+  Word dog = {.word = "dog"};
+  char path[] = "/tmp/hashset-trace-XXXXXX";
+  const int fd = mkstemp(path);
+  assert(fd >= 0);
+  assert(close(fd) == 0);
+  TraceWriter writer;
+  assert(HashSetTraceStart(&set, path, WordKeyBytes, &writer));
+  HashSetAdd(&set, &cat);
+  HashSetAdd(&set, &dog);
+  assert(HashSetGetByKey(&set, "cat", StringHash, WordKeyCompare) == &cat);
+  assert(!HashSetContainsByKey(&set, "cow", StringHash, WordKeyCompare));
+  HashSetRemoveByKey(&set, "dog", StringHash, WordKeyCompare);
+  HashSetRemoveByKey(&set, "emu", StringHash, WordKeyCompare);
+  assert(HashSetTraceStop(&set, &writer));
+  HashSetDelete(&set);
+
+  const ExpectedEvent expected[] = {
+      {HashSetTraceAdd, "cat"},
+      {HashSetTraceAdd, "dog"},
+      {HashSetTraceGet, "cat"},
+      {HashSetTraceRemove, "dog"},
+  };
+  CheckTraceEvents(path, expected, COUNT(expected));
+}
+
 // Example: Using a `HashSet` to test the time- and space-efficiency of
 // `HashSet` itself.
 
@@ -354,6 +1779,38 @@ int main(int count, char* arguments[]) {
   TestAddContains();
   TestAddContainsGetUpdate();
   TestIterator();
+  TestWithHash();
+  TestByKey();
+  TestTraceByKey();
+  TestTraceInternalPasses();
+  TestSetAlgebra();
+  TestBuildParallel();
+  TestForEachParallel();
+  TestSnapshot();
+  TestFreeze();
+  TestFilter();
+  TestCallocHuge();
+  TestCuckoo();
+  TestCuckooCollisions();
+  TestRobinHood();
+  TestSorted();
+  TestTreeify();
+  TestSmall();
+  TestBounded();
+  TestExpiring();
+  TestExpiringReplacement();
+  TestBoundedExpiring();
+  TestCounterMap();
+  TestInterner();
+  TestLoadLines();
+  TestTrace();
+  TestTraceEvictions();
+  TestChunked();
+  TestChunkedTags();
+  TestCompact();
+  TestCompactTags();
+  TestInline();
+  TestInlineTagged();
   if (count > 1 && StringEquals(arguments[1], "uniformity")) {
     TestStringHashUniformity();
   }
@@ -0,0 +1,51 @@
+// Copyright 2023 Chris Palmer, https://noncombatant.org/
+// SPDX-License-Identifier: Apache-2.0
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "timing.h"
+
+static int CompareUint64(const void* a, const void* b) {
+  const uint64_t* x = a;
+  const uint64_t* y = b;
+  if (*x < *y) {
+    return -1;
+  } else if (*x > *y) {
+    return 1;
+  }
+  return 0;
+}
+
+uint64_t Nanos(void) {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return (uint64_t)t.tv_sec * 1000000000 + (uint64_t)t.tv_nsec;
+}
+
+double Now(void) {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return (double)t.tv_sec + (double)t.tv_nsec / 1e9;
+}
+
+void PrintLatencies(const char* label, uint64_t* latencies, size_t count) {
+  qsort(latencies, count, sizeof(uint64_t), CompareUint64);
+  printf("%-24s p50 %4llu  p90 %4llu  p99 %4llu  p99.9 %5llu  max %6llu ns\n",
+         label, (unsigned long long)latencies[count / 2],
+         (unsigned long long)latencies[count * 9 / 10],
+         (unsigned long long)latencies[count * 99 / 100],
+         (unsigned long long)latencies[count * 999 / 1000],
+         (unsigned long long)latencies[count - 1]);
+}
+
+uint64_t TimerOverhead(void) {
+  uint64_t overhead = UINT64_MAX;
+  for (size_t i = 0; i < 1000; i++) {
+    const uint64_t start = Nanos();
+    const uint64_t elapsed = Nanos() - start;
+    overhead = elapsed < overhead ? elapsed : overhead;
+  }
+  return overhead;
+}
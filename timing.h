@@ -0,0 +1,24 @@
+// Copyright 2023 Chris Palmer, https://noncombatant.org/
+// SPDX-License-Identifier: Apache-2.0
+
+#ifndef TIMING_H
+#define TIMING_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Clocks and latency reports for benchmark.c, replay.c, and traces.
+
+// Returns the time, in nanoseconds, since some arbitrary point.
+uint64_t Nanos(void);
+
+// Returns the time, in seconds, since some arbitrary point.
+double Now(void);
+
+// Sorts the `count` `latencies`, and prints their distribution.
+void PrintLatencies(const char* label, uint64_t* latencies, size_t count);
+
+// Returns the shortest time `Nanos` takes to measure nothing.
+uint64_t TimerOverhead(void);
+
+#endif
@@ -0,0 +1,210 @@
+// Copyright 2023 Chris Palmer, https://noncombatant.org/
+// SPDX-License-Identifier: Apache-2.0
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "timing.h"
+#include "trace.h"
+
+// The file format is `Magic`, followed by 1 record for each operation:
+//
+//   1 byte: the `HashSetTraceOperation`
+//   varint: nanoseconds since the previous record (or since tracing started)
+//   unless the operation is `HashSetTraceIterate`:
+//     8 bytes: the hash
+//     varint: the length of the key part
+//     the key part
+//
+// Varints are little-endian, base 128: 7 bits per byte, with the high bit set
+// on every byte but the last. Most operations follow the previous one within
+// a few microseconds, so their times take 1 or 2 bytes.
+
+// “HSTRACE1”, in little-endian byte order.
+static const uint64_t Magic = 0x3145434152545348;
+
+enum { MaxVarintSize = 10 };
+
+// Writes `n` as a varint at `p`, and returns the number of bytes written.
+static size_t PutVarint(uint8_t* p, uint64_t n) {
+  size_t i = 0;
+  while (n >= 0x80) {
+    p[i++] = (uint8_t)(n | 0x80);
+    n >>= 7;
+  }
+  p[i++] = (uint8_t)n;
+  return i;
+}
+
+// Reads a varint from `*p`, which must be before `end`, and advances `*p` past
+// it. Returns false if the varint is truncated or too long.
+static bool GetVarint(const uint8_t** p, const uint8_t* end, uint64_t* n) {
+  *n = 0;
+  for (size_t shift = 0; *p < end && shift < 64; shift += 7) {
+    const uint8_t byte = *(*p)++;
+    *n |= (uint64_t)(byte & 0x7f) << shift;
+    if (byte < 0x80) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static void Record(enum HashSetTraceOperation operation,
+                   const void* element,
+                   size_t hash,
+                   void* context) {
+  TraceWriter* writer = context;
+  const uint64_t now = Nanos();
+  uint8_t record[1 + MaxVarintSize + sizeof(uint64_t) + MaxVarintSize];
+  size_t n = 0;
+  record[n++] = (uint8_t)operation;
+  n += PutVarint(&record[n], now - writer->last);
+  writer->last = now;
+  if (operation == HashSetTraceIterate) {
+    // Write errors stick to `file`, for `HashSetTraceStop` to report.
+    (void)fwrite(record, 1, n, writer->file);
+    return;
+  }
+
+  const uint64_t h = hash;
+  memcpy(&record[n], &h, sizeof(h));
+  n += sizeof(h);
+  const void* bytes;
+  const size_t length = writer->key_bytes(element, &bytes);
+  n += PutVarint(&record[n], length);
+  (void)fwrite(record, 1, n, writer->file);
+  (void)fwrite(bytes, 1, length, writer->file);
+}
+
+bool HashSetTraceStart(HashSet* set,
+                       const char* path,
+                       KeyBytes* key_bytes,
+                       TraceWriter* writer) {
+  *writer = (TraceWriter){.file = fopen(path, "wb"),
+                          .key_bytes = key_bytes,
+                          .last = Nanos()};
+  if (writer->file == NULL) {
+    return false;
+  }
+  if (fwrite(&Magic, sizeof(Magic), 1, writer->file) != 1) {
+    const int error = errno;
+    (void)fclose(writer->file);
+    errno = error;
+    return false;
+  }
+
+  HashSetIterator it = HashSetIteratorNew(set);
+  void* element;
+  while ((element = HashSetIteratorNext(&it))) {
+    Record(HashSetTraceAdd, element, set->hasher(element), writer);
+  }
+  set->tracer = Record;
+  set->tracer_context = writer;
+  return true;
+}
+
+bool HashSetTraceStop(HashSet* set, TraceWriter* writer) {
+  set->tracer = NULL;
+  set->tracer_context = NULL;
+  const bool ok = ferror(writer->file) == 0;
+  const int error = errno;
+  if (fclose(writer->file) != 0) {
+    return false;
+  }
+  writer->file = NULL;
+  errno = error;
+  return ok;
+}
+
+// Decodes the records from `p` to `end` into `events`, or just counts them if
+// `events` is `NULL`. Returns false if the records are malformed.
+static bool Decode(const uint8_t* p,
+                   const uint8_t* end,
+                   TraceEvent* events,
+                   size_t* count) {
+  uint64_t time = 0;
+  for (*count = 0; p < end; (*count)++) {
+    TraceEvent e = {.operation = *p++};
+    uint64_t delta;
+    if (e.operation > HashSetTraceIterate || !GetVarint(&p, end, &delta)) {
+      return false;
+    }
+    time += delta;
+    e.time = time;
+    if (e.operation != HashSetTraceIterate) {
+      uint64_t length;
+      if ((size_t)(end - p) < sizeof(e.hash)) {
+        return false;
+      }
+      memcpy(&e.hash, p, sizeof(e.hash));
+      p += sizeof(e.hash);
+      if (!GetVarint(&p, end, &length) || length > (size_t)(end - p)) {
+        return false;
+      }
+      e.bytes = (const char*)p;
+      e.length = (size_t)length;
+      p += length;
+    }
+    if (events) {
+      events[*count] = e;
+    }
+  }
+  return true;
+}
+
+Trace TraceOpen(const char* path) {
+  Trace trace = {0};
+  const int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    return trace;
+  }
+  struct stat status;
+  if (fstat(fd, &status) != 0) {
+    (void)close(fd);
+    return trace;
+  }
+  const size_t length = (size_t)status.st_size;
+  if (length < sizeof(Magic)) {
+    (void)close(fd);
+    errno = EINVAL;
+    return trace;
+  }
+  void* mapping = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+  const int error = errno;
+  (void)close(fd);
+  if (mapping == MAP_FAILED) {
+    errno = error;
+    return trace;
+  }
+
+  uint64_t magic;
+  memcpy(&magic, mapping, sizeof(magic));
+  const uint8_t* start = (const uint8_t*)mapping + sizeof(Magic);
+  const uint8_t* end = (const uint8_t*)mapping + length;
+  size_t count;
+  if (magic != Magic || !Decode(start, end, NULL, &count)) {
+    (void)munmap(mapping, length);
+    errno = EINVAL;
+    return trace;
+  }
+  // Allocate at least 1, so that `events` is never `NULL`.
+  trace.events = calloc(count + 1, sizeof(TraceEvent));
+  (void)Decode(start, end, trace.events, &trace.count);
+  trace.mapping = mapping;
+  trace.length = length;
+  return trace;
+}
+
+void TraceClose(Trace* trace) {
+  (void)munmap(trace->mapping, trace->length);
+  trace->mapping = NULL;
+  free(trace->events);
+  trace->events = NULL;
+}
@@ -0,0 +1,85 @@
+// Copyright 2023 Chris Palmer, https://noncombatant.org/
+// SPDX-License-Identifier: Apache-2.0
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "hashset.h"
+
+// Traces record the operations on a `HashSet` in a compact binary file, so that
+// replay.c can re-run them against other set implementations and
+// configurations, and measure how those would have performed on real traffic.
+//
+// For each operation, a trace records its `HashSetTraceOperation`, its time,
+// and (except for iterations) the hash and the bytes of the key part of its
+// element. The replay sees only those bytes, so the key part must compare
+// equal exactly when its bytes do: a C string, say, or a structure of integers
+// without padding. Like snapshots, traces are in the host’s byte order.
+//
+// Evictions from bounded sets, and removals by `HashSetReapExpired`, appear as
+// removes. Lookups and removals by key (`HashSetGetByKey` and so on) appear as
+// gets and removes of the elements they find; lookups by key that find nothing
+// are not traced, because there is no element to record. Range iterators are
+// not traced, and nor are the passes that set operations, `HashSetBuildFilter`,
+// and `HashSetFreeze` make over a set.
+
+// Sets `*bytes` to the start of the key part of `element`, and returns its
+// length in bytes. For example, for C strings, this would set `*bytes` to
+// `element` and return `strlen(element)`.
+typedef size_t KeyBytes(const void* element, const void** bytes);
+
+typedef struct TraceWriter {
+  FILE* file;
+  KeyBytes* key_bytes;
+  // The time of the last operation, in nanoseconds since some arbitrary point.
+  uint64_t last;
+} TraceWriter;
+
+// Starts recording the operations on `set` to a new trace file at `path`. The
+// trace begins with an add of each element already in `set`, so that replaying
+// it rebuilds the set. `writer` must remain valid until `HashSetTraceStop`.
+//
+// Returns false (and sets `errno`) on error.
+bool HashSetTraceStart(HashSet* set,
+                       const char* path,
+                       KeyBytes* key_bytes,
+                       TraceWriter* writer);
+
+// Stops recording, and closes the trace file. Returns false (and sets `errno`)
+// if writing any of the trace failed.
+bool HashSetTraceStop(HashSet* set, TraceWriter* writer);
+
+typedef struct TraceEvent {
+  // In nanoseconds since tracing started.
+  uint64_t time;
+  uint64_t hash;
+  // The key part of the element, in the trace’s mapping, or `NULL` for
+  // `HashSetTraceIterate`.
+  const char* bytes;
+  size_t length;
+  // A `HashSetTraceOperation`.
+  size_t operation;
+} TraceEvent;
+
+typedef struct Trace {
+  TraceEvent* events;
+  // The number of events.
+  size_t count;
+  void* mapping;
+  size_t length;
+} Trace;
+
+// Maps the trace at `path`, and decodes its events.
+//
+// On error, returns a `Trace` whose `mapping` is `NULL`, and sets `errno`.
+Trace TraceOpen(const char* path);
+
+// Unmaps `trace`, and `free`s its events. Their `bytes` are no longer valid.
+void TraceClose(Trace* trace);
+
+#endif
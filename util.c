@@ -1,24 +1,120 @@
 // Copyright 2023 Chris Palmer, https://noncombatant.org/
 // SPDX-License-Identifier: Apache-2.0
 
+#include <sys/mman.h>
+
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "util.h"
 
+static const size_t HugePageSize = 2 << 20;
+
+static const size_t CacheLineSize = 64;
+
+size_t HugePageThreshold = 32 << 20;
+
+// Just before each allocation from `CallocHuge` is a header saying how to free
+// it.
+typedef struct HugeHeader {
+  // The start of the underlying allocation or mapping.
+  void* base;
+  // The length of the mapping, or 0 if `base` came from `calloc`.
+  size_t mapped;
+} HugeHeader;
+
+// Returns `p` rounded up to a multiple of `alignment`, a power of 2.
+static char* AlignUp(char* p, size_t alignment) {
+  return p + (-(uintptr_t)p & (alignment - 1));
+}
+
+void* CallocHuge(size_t count, size_t size) {
+  if (size != 0 && count > SIZE_MAX / size) {
+    return NULL;
+  }
+  const size_t bytes = count * size;
+  if (bytes < HugePageThreshold) {
+    if (bytes > SIZE_MAX - CacheLineSize - sizeof(HugeHeader)) {
+      return NULL;
+    }
+    char* base = calloc(1, bytes + CacheLineSize + sizeof(HugeHeader));
+    if (base == NULL) {
+      return NULL;
+    }
+    char* p = AlignUp(base + sizeof(HugeHeader), CacheLineSize);
+    memcpy(p - sizeof(HugeHeader), &(HugeHeader){.base = base, .mapped = 0},
+           sizeof(HugeHeader));
+    return p;
+  }
+
+  // Anonymous mappings are already zeroed, and the kernel supplies their pages
+  // only as they are first touched. Map an extra huge page, to make room for
+  // aligning the allocation and for the header.
+  const size_t rounded =
+      (bytes + HugePageSize - 1) / HugePageSize * HugePageSize;
+  if (rounded < bytes || rounded > SIZE_MAX - HugePageSize) {
+    return NULL;
+  }
+  const size_t mapped = rounded + HugePageSize;
+  char* base =
+      mmap(NULL, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0);
+  if (base == MAP_FAILED) {
+    return NULL;
+  }
+  // `base` is page-aligned, so there is room for the header below `p`.
+  char* p = AlignUp(base + sizeof(HugeHeader), HugePageSize);
+#ifdef MADV_HUGEPAGE
+  // Advise before touching the memory, so that the first touch faults in huge
+  // pages rather than small ones.
+  madvise(p, rounded, MADV_HUGEPAGE);
+#endif
+  memcpy(p - sizeof(HugeHeader), &(HugeHeader){.base = base, .mapped = mapped},
+         sizeof(HugeHeader));
+  return p;
+}
+
 void* CopyNew(const void* source, size_t count) {
   return memcpy(malloc(count), source, count);
 }
 
+void FreeHuge(void* p) {
+  if (p == NULL) {
+    return;
+  }
+  HugeHeader header;
+  memcpy(&header, (char*)p - sizeof(HugeHeader), sizeof(HugeHeader));
+  if (header.mapped) {
+    munmap(header.base, header.mapped);
+  } else {
+    free(header.base);
+  }
+}
+
+size_t MixHash(size_t hash) {
+  // The 64-bit finalizer from MurmurHash3.
+  uint64_t h = hash;
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccd;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53;
+  h ^= h >> 33;
+  return (size_t)h;
+}
+
 bool StringEquals(const char* a, const char* b) {
   return strcmp(a, b) == 0;
 }
 
 size_t StringHash(const void* string) {
+  return StringHashN(string, strlen(string));
+}
+
+size_t StringHashN(const char* string, size_t length) {
   const size_t prime = 31;
   size_t h = 0;
-  for (const unsigned char* p = string; *p != '\0'; p++) {
-    h = prime * h + *p;
+  for (size_t i = 0; i < length; i++) {
+    h = prime * h + (unsigned char)string[i];
   }
   return h;
 }
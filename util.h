@@ -8,10 +8,34 @@
 
 #define COUNT(array) (sizeof((array)) / sizeof((array)[0]))
 
+// Like `calloc`, but aligns the allocation to at least 64 bytes (a cache line).
+// If the allocation is at least `HugePageThreshold` bytes, it is instead a
+// fresh anonymous mapping, aligned to 2 MiB, which the kernel is asked to back
+// with transparent huge pages (where the platform supports `MADV_HUGEPAGE`).
+// Huge pages make random access to very large arrays, like the bucket arrays
+// of big sets, miss the TLB far less often. The mapping is zeroed by the
+// kernel, page by page as it is first touched, rather than all at once.
+//
+// Free the allocation with `FreeHuge`, not `free`.
+void* CallocHuge(size_t count, size_t size);
+
 // Allocates `count` bytes on the heap, copies `count` bytes from `source` into
 // that allocation, and returns a pointer to the allocation.
 void* CopyNew(const void* source, size_t count);
 
+// Frees an allocation from `CallocHuge`. Does nothing if `p` is `NULL`.
+void FreeHuge(void* p);
+
+// The smallest allocation for which `CallocHuge` uses huge pages. Set it to
+// `SIZE_MAX` to disable them. The default is 32 MiB.
+extern size_t HugePageThreshold;
+
+// Returns a thoroughly scrambled version of `hash`, so that every bit of the
+// result depends on every bit of `hash`. Use this to derive well-distributed
+// bits from a `Hasher` that might not provide them (e.g. one that returns an
+// integer key unchanged).
+size_t MixHash(size_t hash);
+
 // Returns true if `a` equals `b`.
 bool StringEquals(const char* a, const char* b);
 
@@ -19,4 +43,8 @@ bool StringEquals(const char* a, const char* b);
 // hash of it.
 size_t StringHash(const void* key);
 
+// Returns the same hash as `StringHash`, but of the `length` bytes at `string`,
+// which need not be `NUL`-terminated.
+size_t StringHashN(const char* string, size_t length);
+
 #endif